@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Microbenchmarks for the PM service running against the simulated register
+ * file. Every operation goes through the portal handler in main.cpp so the
+ * numbers include UTCB decoding and dispatch, exactly what a client pays on
+ * the service side of a portal call. MMIO and firmware counts are reported
+ * per call next to the latency since on hardware each device access costs
+ * far more than it does here.
+ */
+
+#include <new>
+#include <rpi4.hpp>
+#include <sim.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct bench {
+    const char *name;
+    /* untimed, puts the driver in the state the measured call expects */
+    void (*prepare)(uint32 iter);
+    Errno (*run)(uint32 iter);
+};
+
+static Pbl::Utcb boot_utcb;
+
+static inline uint64
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64>(ts.tv_sec) * 1000000000ull + static_cast<uint64>(ts.tv_nsec);
+}
+
+/* a client on cpu, served by that CPU's EC through its own UTCB */
+template<typename ARGS, typename... T>
+static Errno
+call_on(Cpu cpu, T... args) {
+    ARGS *msg = new (reinterpret_cast<void *>(Sim::utcb(cpu))) ARGS(args...);
+    Sim::portal(cpu, msg->size());
+    return reinterpret_cast<drv_ipc::ret *>(Sim::utcb(cpu))->errno;
+}
+
+template<typename ARGS, typename... T>
+static Errno
+call(T... args) {
+    return call_on<ARGS>(0, args...);
+}
+
+/* clocks that are gated at boot and safe to toggle */
+static constexpr uint8 toggle_clks[] = {BCM2835_CLOCK_H264, BCM2835_CLOCK_ISP, BCM2835_CLOCK_PWM,
+                                        BCM2835_CLOCK_GP0,  BCM2835_CLOCK_GP1, BCM2835_CLOCK_SMI,
+                                        BCM2835_CLOCK_DPI,  BCM2835_CLOCK_CAM0};
+static constexpr uint32 NUM_TOGGLE_CLKS = sizeof(toggle_clks) / sizeof(toggle_clks[0]);
+
+/* leaves at different depths of the tree */
+static constexpr uint8 rate_clks[] = {BCM2711_CLOCK_EMMC2, BCM2835_CLOCK_V3D,
+                                      BCM2835_CLOCK_UART,  BCM2835_CLOCK_TIMER,
+                                      BCM2835_PLLD_PER,    BCM2835_CLOCK_PERI_IMAGE};
+static constexpr uint32 NUM_RATE_CLKS = sizeof(rate_clks) / sizeof(rate_clks[0]);
+
+/* user LED plus the 40-pin header GPIOs most HATs use */
+static constexpr uint32 pinctrl_pins[] = {42, 4, 5, 6, 12, 13, 16, 17, 22, 23, 24, 25, 26, 27};
+static constexpr uint32 NUM_PINCTRL_PINS = sizeof(pinctrl_pins) / sizeof(pinctrl_pins[0]);
+
+static Errno
+pinctrl(uint32 func, uint32 val) {
+    Pm::Pin pins[NUM_PINCTRL_PINS];
+    for (uint32 i = 0; i < NUM_PINCTRL_PINS; i++) {
+        pins[i].id = pinctrl_pins[i];
+        pins[i].val = val;
+    }
+    return call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(func), pins, NUM_PINCTRL_PINS);
+}
+
+/* a state dump of every input, one entry per pin */
+static Errno
+get_all_gpios(void) {
+    Pm::Pin pins[NUM_GPIO];
+    for (uint32 i = 0; i < NUM_GPIO; i++)
+        pins[i] = {i, 0};
+    return call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_GET_GPIO), pins, NUM_GPIO);
+}
+
+/* the SET_GPIO x14 pattern as two masks */
+static Errno
+set_bank(uint32 iter) {
+    uint64 pins = 0;
+    for (uint32 i = 0; i < NUM_PINCTRL_PINS; i++)
+        pins |= 1ull << pinctrl_pins[i];
+    uint64 set = (iter & 1) ? pins : 0;
+    return call<drv_ipc::gpio_bank_args>(static_cast<uint8>(PM_SET_GPIOBANK), set, pins & ~set);
+}
+
+/* EMMC2 bring-up: PLL channel, bus gate, then the leaf at its rate */
+static Errno
+clk_batch(void) {
+    drv_ipc::clk_batch_entry clks[] = {
+        {BCM2835_PLLD_PER, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+        {BCM2835_CLOCK_PERI_IMAGE, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+        {BCM2711_CLOCK_EMMC2, drv_ipc::CLK_OP_SET_RATE, 100000000ull, 0, 0},
+        {BCM2711_CLOCK_EMMC2, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+    };
+    return call<drv_ipc::clk_batch_args_ipc>(clks,
+                                             static_cast<uint32>(sizeof(clks) / sizeof(clks[0])));
+}
+
+/* firmware busy for a while, e.g. waiting for a power island to settle */
+static constexpr uint32 SLOW_FW_POLLS = 64;
+static uint32 node_token;
+static bool node_posted;
+
+static void
+slow_fw_prepare(uint32) {
+    Sim::set_fw_latency(0);
+    /* collect the previous transition, its result would be kept forever */
+    while (node_posted
+           && call<drv_ipc::node_complete_args>(node_token) == Errno::EBUSY) {}
+    node_posted = false;
+    call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D);
+    Sim::set_fw_latency(SLOW_FW_POLLS);
+}
+
+static Errno
+post_node(void) {
+    Errno err = call<drv_ipc::node_set_async_args>(RPI_POWER_DOMAIN_V3D, 1u);
+    node_token = reinterpret_cast<drv_ipc::node_set_async_ret *>(Sim::utcb())->token;
+    node_posted = (err == Errno::ENONE);
+    return err;
+}
+
+/* leaves a transition in flight; EBUSY is what the timed call should see */
+static void
+slow_fw_post(uint32 i) {
+    slow_fw_prepare(i);
+    post_node();
+}
+
+/* a private transport on the driver's mailbox and page, for rpi_fw on its own */
+static constexpr uint32 BENCH_FW_MBOX_OFFSET = 0x880; /* see rpi4.cpp */
+static rpi_fw fw;
+
+/* what a board bringing up its media blocks powers at boot */
+static constexpr uint32 boot_pds[] = {RPI_POWER_DOMAIN_USB, RPI_POWER_DOMAIN_V3D,
+                                      RPI_POWER_DOMAIN_H264, RPI_POWER_DOMAIN_ISP,
+                                      RPI_POWER_DOMAIN_HDMI};
+static constexpr uint32 NUM_BOOT_PDS = sizeof(boot_pds) / sizeof(boot_pds[0]);
+
+static void
+fw_init(void) {
+    mword va = FW_BASE, pa;
+    Pbl::API::dma_mmap(&boot_utcb, va, PAGE_SIZE, 0xd, false, pa);
+    fw.init(reinterpret_cast<void *>(MBOX_BASE + BENCH_FW_MBOX_OFFSET),
+            reinterpret_cast<void *>(va), PAGE_SIZE, reinterpret_cast<void *>(pa));
+}
+
+/* domains are refcounted, leave each boot domain off with no reference held */
+static void
+slow_fw_boot_nodes_off(uint32 i) {
+    slow_fw_prepare(i);
+    Sim::set_fw_latency(0);
+    for (uint32 pd : boot_pds)
+        call<drv_ipc::node_disable_args>(pd);
+    Sim::set_fw_latency(SLOW_FW_POLLS);
+}
+
+/* V3D on with exactly one reference, whatever the previous case left */
+static void
+v3d_held_once(uint32) {
+    call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D);
+    call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D);
+}
+
+/* a second guest using V3D while the first keeps it powered */
+static Errno
+v3d_shared(void) {
+    Errno err = call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D);
+    if (err != Errno::ENONE) return err;
+    return call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D);
+}
+
+/* V3D device node against the calls a client used to make for it */
+static constexpr uint64 V3D_RATE = 500000000ull;
+
+/* drop whatever reference the previous case holds, device node or parts */
+static void
+v3d_off(uint32) {
+    call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D);
+    call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_V3D);
+    call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D);
+}
+
+static Errno
+v3d_parts_on(void) {
+    Errno err = call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D);
+    if (err == Errno::ENONE) err = call<drv_ipc::clk_set_rate_args>(BCM2835_CLOCK_V3D, V3D_RATE);
+    if (err == Errno::ENONE) err = call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_V3D);
+    return err;
+}
+
+/* a guest that releases V3D after every burst of work and takes it back for the next */
+static constexpr uint64 V3D_IDLE_US = 1000;
+
+static void
+v3d_node_held(uint32 i) {
+    v3d_off(i);
+    call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D);
+}
+
+static void
+v3d_autosuspend(uint32 i) {
+    call<drv_ipc::autosuspend_args>(drv_ipc::AUTOSUSPEND_NODE, drv_ipc::NODE_V3D, V3D_IDLE_US);
+    v3d_node_held(i);
+}
+
+static Errno
+v3d_burst(void) {
+    Errno err = call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D);
+    if (err != Errno::ENONE) return err;
+    return call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D);
+}
+
+/* after the last burst V3D is gated by the first timer check past the delay */
+static Errno
+v3d_idle(void) {
+    Errno err = call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D);
+    Sim::advance(2 * V3D_IDLE_US * 1000);
+    call<drv_ipc::autosuspend_args>(drv_ipc::AUTOSUSPEND_NODE, drv_ipc::NODE_V3D, V3D_IDLE_US);
+
+    const drv_ipc::status_page *page = reinterpret_cast<drv_ipc::status_page *>(STATUS_BASE);
+    bool on = page->clks[BCM2835_CLOCK_V3D].enabled || page->node_state[RPI_POWER_DOMAIN_V3D];
+    return (err == Errno::ENONE && !on) ? Errno::ENONE : Errno::EBUSY;
+}
+
+static void
+boot_pds_off(uint32) {
+    Sim::set_fw_latency(0);
+    fw.set_power_domains(boot_pds, NUM_BOOT_PDS, 0);
+}
+
+/* several transitions in flight at once, each in its own firmware slot */
+static Errno
+post_nodes_then_collect(void) {
+    uint32 tokens[NUM_BOOT_PDS];
+    Errno err = Errno::ENONE;
+
+    for (uint32 i = 0; i < NUM_BOOT_PDS; i++) {
+        if (call<drv_ipc::node_set_async_args>(boot_pds[i], 1u) != Errno::ENONE)
+            return Errno::ENOMEM;
+        tokens[i] = reinterpret_cast<drv_ipc::node_set_async_ret *>(Sim::utcb())->token;
+    }
+    for (uint32 i = 0; i < NUM_BOOT_PDS; i++) {
+        Errno e;
+        while ((e = call<drv_ipc::node_complete_args>(tokens[i])) == Errno::EBUSY) {}
+        if (e != Errno::ENONE) err = e;
+    }
+    return err;
+}
+
+/* a PLL that never locks must fail the enable in bounded time and roll back */
+static void
+pll_stuck_prepare(uint32) {
+    Sim::set_pll_stuck(CM_LOCK_FLOCKA);
+}
+
+static Errno
+enable_stuck_pll(void) {
+    Errno err = call<drv_ipc::clk_enable_args>(BCM2835_PLLA_PER);
+    bool leaked = call<drv_ipc::clk_is_enabled_args>(BCM2835_PLLA) == Errno::ENONE
+                  && reinterpret_cast<drv_ipc::clk_is_enabled_ret *>(Sim::utcb())->enabled;
+    Sim::set_pll_stuck(0);
+    return (err == Errno::ETIMEDOUT && !leaked) ? Errno::ENONE : Errno::EINVAL;
+}
+
+/* a button press on a rising-edge pin, seen by a polling and a subscribed client */
+static constexpr uint32 POLL_PIN = 22;
+static constexpr uint32 EVT_PIN = 17;
+static Sel evt_sm;
+static drv_ipc::gpio_evt_ring *evt_ring;
+
+static void
+gpio_evt_init(void) {
+    Pm::Pin pins[] = {{POLL_PIN, Pm::iotrig::EDGE_RISE}, {EVT_PIN, Pm::iotrig::EDGE_RISE}};
+    call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_SET_GPIOTRIG), pins, 2u);
+
+    call<drv_ipc::gpio_evt_subscribe_args>(1ull << EVT_PIN);
+    drv_ipc::gpio_evt_subscribe_ret *ret
+        = reinterpret_cast<drv_ipc::gpio_evt_subscribe_ret *>(Sim::utcb());
+    evt_sm = ret->sm;
+    evt_ring = reinterpret_cast<drv_ipc::gpio_evt_ring *>(EVT_BASE + ret->client * PAGE_SIZE);
+}
+
+/* the SET_GPIO cases may have left the pads high, release the buttons first */
+static void
+release_buttons(uint32) {
+    Sim::set_gpio_input(POLL_PIN, false);
+    Sim::set_gpio_input(EVT_PIN, false);
+}
+
+static Errno
+press_polled(void) {
+    Pm::Pin pin = {POLL_PIN, 0};
+    Sim::set_gpio_input(POLL_PIN, true);
+    call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_GET_GPIOEVT), &pin, 1u);
+    bool seen = reinterpret_cast<drv_ipc::pinctrl_ret_ipc *>(Sim::utcb())->pins[0].val;
+    call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_CLR_GPIOEVT), &pin, 1u);
+    return seen ? Errno::ENONE : Errno::ENOENT;
+}
+
+static Errno
+press_irq(void) {
+    Sim::set_gpio_input(EVT_PIN, true);
+    bool seen = false;
+    while (Sim::sm_try_down(evt_sm)) {
+        for (uint32 t = evt_ring->tail; t != evt_ring->head; t++)
+            seen |= evt_ring->evts[t % drv_ipc::gpio_evt_ring::SIZE].pin == EVT_PIN;
+        evt_ring->tail = evt_ring->head;
+    }
+    return seen ? Errno::ENONE : Errno::ENOENT;
+}
+
+/* a monitoring client's poll: rate and enable bit of every clock */
+static Errno
+poll_clocks_ipc(void) {
+    uint64 sum = 0;
+    for (uint8 id = 0; id < BCM2711_CLOCK_TOTAL; id++) {
+        if (call<drv_ipc::clk_get_rate_args>(id) != Errno::ENONE) continue;
+        sum += reinterpret_cast<drv_ipc::clk_get_rate_ret *>(Sim::utcb())->rate;
+        call<drv_ipc::clk_is_enabled_args>(id);
+        sum += reinterpret_cast<drv_ipc::clk_is_enabled_ret *>(Sim::utcb())->enabled;
+    }
+    return sum ? Errno::ENONE : Errno::EINVAL;
+}
+
+/* the same from the status page, mapped where the driver put it */
+static Errno
+poll_clocks_page(void) {
+    const drv_ipc::status_page *page = reinterpret_cast<drv_ipc::status_page *>(STATUS_BASE);
+    drv_ipc::status_page::clk clks[drv_ipc::status_page::MAX_CLKS];
+    uint32 seq;
+
+    do {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        for (uint32 i = 0; i < page->num_clks; i++)
+            clks[i] = page->clks[i];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&page->seq, __ATOMIC_RELAXED));
+
+    uint64 sum = 0;
+    for (uint32 i = 0; i < page->num_clks; i++)
+        sum += clks[i].rate + clks[i].enabled;
+    return (page->magic == drv_ipc::status_page::MAGIC && sum) ? Errno::ENONE : Errno::EINVAL;
+}
+
+static const bench benches[] = {
+    {"portal dispatch (CLK_GET_MAX)", nullptr,
+     [](uint32) { return call<drv_ipc::clk_get_max_args>(); }},
+    {"STATS_GET (all statistics)", nullptr,
+     [](uint32) { return call<drv_ipc::stats_get_args>(0u); }},
+    {"Rpi4::enable_clk",
+     [](uint32 i) { call<drv_ipc::clk_disable_args>(toggle_clks[i % NUM_TOGGLE_CLKS]); },
+     [](uint32 i) { return call<drv_ipc::clk_enable_args>(toggle_clks[i % NUM_TOGGLE_CLKS]); }},
+    {"Rpi4::disable_clk",
+     [](uint32 i) { call<drv_ipc::clk_enable_args>(toggle_clks[i % NUM_TOGGLE_CLKS]); },
+     [](uint32 i) { return call<drv_ipc::clk_disable_args>(toggle_clks[i % NUM_TOGGLE_CLKS]); }},
+    {"Rpi4::enable_clk (PLLA never locks)", pll_stuck_prepare,
+     [](uint32) { return enable_stuck_pll(); }},
+    {"Rpi4::is_clk_enabled", nullptr,
+     [](uint32 i) { return call<drv_ipc::clk_is_enabled_args>(rate_clks[i % NUM_RATE_CLKS]); }},
+    {"Rpi4::get_clkrate", nullptr,
+     [](uint32 i) { return call<drv_ipc::clk_get_rate_args>(rate_clks[i % NUM_RATE_CLKS]); }},
+    {"Rpi4::get_clkrate (CPU 0-3 portals)", nullptr,
+     [](uint32 i) {
+         return call_on<drv_ipc::clk_get_rate_args>(i % PM_MAX_CPUS, rate_clks[i % NUM_RATE_CLKS]);
+     }},
+    {"Rpi4::describe_clkrate", nullptr,
+     [](uint32 i) { return call<drv_ipc::clk_describe_rate_args>(rate_clks[i % NUM_RATE_CLKS]); }},
+    {"Rpi4::round_clkrate (EMMC2)", nullptr,
+     [](uint32 i) {
+         return call<drv_ipc::clk_round_rate_args>(BCM2711_CLOCK_EMMC2, 25000000ull + i * 1000ull);
+     }},
+    {"Rpi4::set_clkrate (EMMC2)", nullptr,
+     [](uint32 i) {
+         return call<drv_ipc::clk_set_rate_args>(BCM2711_CLOCK_EMMC2,
+                                                 (i & 1) ? 100000000ull : 50000000ull);
+     }},
+    {"Rpi4::handle_clk_batch (EMMC2 bring-up x4)", nullptr, [](uint32) { return clk_batch(); }},
+    {"monitor poll, all clocks (portal calls)", nullptr, [](uint32) { return poll_clocks_ipc(); }},
+    {"monitor poll, all clocks (status page)", nullptr, [](uint32) { return poll_clocks_page(); }},
+    {"Rpi4::handle_pinctrl (SET_GPIO x14)", nullptr,
+     [](uint32 i) { return pinctrl(PM_SET_GPIO, i & 1); }},
+    {"Rpi4::handle_pinctrl (GET_GPIO x14)", nullptr,
+     [](uint32) { return pinctrl(PM_GET_GPIO, 0); }},
+    {"Rpi4::handle_pinctrl (GET_GPIO x58)", nullptr, [](uint32) { return get_all_gpios(); }},
+    {"Rpi4::handle_gpio_bank (GET_GPIOBANK)", nullptr,
+     [](uint32) { return call<drv_ipc::gpio_bank_args>(static_cast<uint8>(PM_GET_GPIOBANK)); }},
+    {"Rpi4::handle_gpio_bank (SET_GPIOBANK x14)", nullptr, [](uint32 i) { return set_bank(i); }},
+    {"Rpi4::handle_pinctrl (SET_PINFUNC x14)", nullptr,
+     [](uint32 i) { return pinctrl(PM_SET_PINFUNC, 1 + (i & 1)); }},
+    {"GPIO edge, polled (GET+CLR GPIOEVT)", release_buttons,
+     [](uint32) { return press_polled(); }},
+    {"GPIO edge, interrupt to client ring", release_buttons, [](uint32) { return press_irq(); }},
+    {"Rpi4::enable_node (set_power_domain)",
+     [](uint32) { call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D); },
+     [](uint32) { return call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D); }},
+    {"Rpi4::disable_node (set_power_domain)", v3d_held_once,
+     [](uint32) { return call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D); }},
+    {"Rpi4::enable+disable_node (V3D held)", v3d_held_once,
+     [](uint32) { return v3d_shared(); }},
+    {"Rpi4::enable_node (V3D device node)", v3d_off,
+     [](uint32) { return call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D); }},
+    {"V3D bring-up as domain, rate, clock calls", v3d_off, [](uint32) { return v3d_parts_on(); }},
+    {"rpi_fw::set_power_domain (x5)", boot_pds_off,
+     [](uint32) {
+         Errno err = Errno::ENONE;
+         for (uint32 pd : boot_pds)
+             if (fw.set_power_domain(pd, 1) != Errno::ENONE) err = Errno::ENOTSUP;
+         return err;
+     }},
+    {"rpi_fw::set_power_domains (x5, one message)", boot_pds_off,
+     [](uint32) { return fw.set_power_domains(boot_pds, NUM_BOOT_PDS, 1); }},
+    {"Rpi4::enable_node (slow fw)", slow_fw_prepare,
+     [](uint32) { return call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D); }},
+    {"Rpi4::post_node_state (slow fw)", slow_fw_prepare, [](uint32) { return post_node(); }},
+    {"Rpi4::complete_node_state (in flight)", slow_fw_post,
+     [](uint32) {
+         Errno err = call<drv_ipc::node_complete_args>(node_token);
+         return (err == Errno::EBUSY) ? Errno::ENONE : err;
+     }},
+    {"Rpi4::post_node_state x5 then complete", slow_fw_boot_nodes_off,
+     [](uint32) { return post_nodes_then_collect(); }},
+    /* last, from here on V3D has an autosuspend delay */
+    {"V3D burst, disable+enable_node", v3d_node_held, [](uint32) { return v3d_burst(); }},
+    {"V3D burst, disable+enable_node (autosuspend)", v3d_autosuspend,
+     [](uint32) { return v3d_burst(); }},
+    {"V3D idle, disable_node then autosuspend", v3d_autosuspend, [](uint32) { return v3d_idle(); }},
+};
+
+/* cost of the two clock reads around every sample */
+static uint64
+timer_overhead(uint32 iters) {
+    uint64 total = 0;
+    for (uint32 i = 0; i < iters; i++) {
+        uint64 start = now_ns();
+        total += now_ns() - start;
+    }
+    return total / iters;
+}
+
+static void
+run_bench(const bench &b, uint32 iters, uint64 overhead) {
+    uint64 total = 0, reads = 0, writes = 0, fw_calls = 0, errors = 0;
+
+    for (uint32 i = 0; i < iters; i++) {
+        if (b.prepare) b.prepare(i);
+
+        Sim::Stats before = Sim::stats();
+        uint64 start = now_ns();
+        Errno err = b.run(i);
+        uint64 end = now_ns();
+        Sim::Stats &after = Sim::stats();
+
+        total += end - start;
+        reads += after.reads - before.reads;
+        writes += after.writes - before.writes;
+        fw_calls += after.fw_calls - before.fw_calls;
+        if (err != Errno::ENONE) errors++;
+    }
+
+    double ns = static_cast<double>(total) / iters - static_cast<double>(overhead);
+    printf("%-42s %10.1f %9.2f %9.2f %7.2f %8lu\n", b.name, ns > 0 ? ns : 0.0,
+           static_cast<double>(reads) / iters, static_cast<double>(writes) / iters,
+           static_cast<double>(fw_calls) / iters, static_cast<unsigned long>(errors));
+}
+
+int
+main(int argc, char **argv) {
+    uint32 iters = (argc > 1) ? static_cast<uint32>(strtoul(argv[1], nullptr, 0)) : 100000;
+    if (iters == 0) iters = 1;
+
+    Sim::init();
+    pbl_main(&boot_utcb, 0);
+    fw_init();
+    gpio_evt_init();
+
+    uint64 overhead = timer_overhead(iters);
+
+    printf("%-42s %10s %9s %9s %7s %8s\n", "operation", "ns/call", "rd/call", "wr/call", "fw/call",
+           "errors");
+    for (const bench &b : benches)
+        run_bench(b, iters, overhead);
+
+    return 0;
+}
@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Host replacement for the Pebble MMIO accessors. Every access is routed to
+ * the simulated register file in host/sim.cpp.
+ */
+
+#pragma once
+#include <pebble/types.hpp>
+
+uint32 ind(mword addr);
+
+void outd(mword addr, uint32 val);
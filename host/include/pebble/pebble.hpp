@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Host replacement for the subset of the Pebble runtime used by the driver.
+ * Portals become plain functions so a harness can call them directly after
+ * filling the UTCB.
+ */
+
+#pragma once
+#include <pebble/io.hpp>
+#include <pebble/types.hpp>
+
+namespace Pbl {
+
+class Utcb {};
+
+mword heap_start();
+
+Sel sels_base();
+
+Errno create_local_ec(Utcb *utcb, Sel ec, Cpu cpu, mword utcb_va, mword sp, Sel evt_base);
+
+namespace API {
+
+enum res_type : mword {
+    RES_REG = 0,
+    RES_IRQ = 1,
+};
+
+Errno acquire_resource(Utcb *utcb, const char *id, res_type type, mword idx, Sel &sel,
+                       mword flags, bool exclusive);
+
+Errno dma_mmap(Utcb *utcb, mword &va, mword size, mword attr, bool cached, mword &pa);
+
+Errno srv_create(Utcb *utcb, Sel ec, const Uuid &uuid, mword crd, mword flags, mword entry);
+
+/* entry runs on a new EC every time irq fires, the interrupt is re-armed after it */
+Errno irq_attach(Utcb *utcb, Sel irq, Sel ec, Cpu cpu, mword utcb_va, mword sp, mword entry);
+
+Errno sm_create(Utcb *utcb, Sel sm, mword count);
+
+Errno sm_up(Sel sm);
+
+}
+
+}
+
+void pbl_main(Pbl::Utcb *utcb, Cpu cpu);
+
+#define PBL_PORTAL(_name_, _ret_, ...) _ret_ _name_(__VA_ARGS__)
+
+#define EXPORT_PORTAL(_name_, _ret_)                                                               \
+    static_assert(sizeof(_ret_) == sizeof(mword), #_name_ " must return a word")
+
+#define PT_ENTRY(_name_) (&_name_)
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Host replacement for the Pebble base types. Only what the driver uses is
+ * provided. Nothing in here may pull in <errno.h>, the driver uses the Errno
+ * enumerators (and a member called errno) unqualified.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef int64_t int64;
+
+typedef unsigned long mword;
+typedef mword Sel;
+typedef mword Cpu;
+
+/* message transfer descriptor of a portal call, only the untyped word count is modelled */
+class Mtd {
+public:
+    explicit constexpr Mtd(mword untyped = 0) : _untyped(untyped) {}
+    constexpr mword untyped() const { return _untyped; }
+
+private:
+    mword _untyped;
+};
+
+#define __ALWAYS_INLINE__ __attribute__((always_inline))
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE (0x1000ul)
+#endif
+
+enum Errno : mword {
+    ENONE = 0,
+    ETIMEDOUT,
+    EABORTED,
+    EOVERFLOW,
+    EBADSEL,
+    EBADPAR,
+    EBADMTD,
+    EBADCPU,
+    ENOMEM,
+    EBUSY,
+    ENOTSUP,
+    EINVAL,
+    EPERM,
+    ENOENT,
+    EAGAIN,
+};
+
+struct Uuid {
+    uint64 lo;
+    uint64 hi;
+};
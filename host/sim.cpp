@@ -0,0 +1,632 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#include <rpi4.hpp>
+#include <sim.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/* should match main.cpp */
+static constexpr mword SIM_UTCB_BASE = DEV_MMIO_END + PAGE_SIZE;
+/* any 16-byte aligned address below 1GiB works, the VPU sees it as 0xc0000000 | pa */
+static constexpr mword SIM_FW_PA = 0x3e000000;
+static constexpr mword SIM_STATUS_PA = SIM_FW_PA + FW_SIZE;
+static constexpr mword SIM_EVT_PA = SIM_STATUS_PA + STATUS_SIZE;
+/* service EC UTCBs, then the one of the GPIO interrupt EC */
+static constexpr mword SIM_IRQ_UTCB = SIM_UTCB_BASE + PM_MAX_CPUS * PAGE_SIZE;
+static constexpr uint32 SIM_MAX_SMS = 8;
+static constexpr uint32 SIM_MAX_NAMES = 8;
+static constexpr uint32 SIM_MBOX_OFFSET = 0x880;
+static constexpr uint32 SIM_MBOX_FIFO_DEPTH = 8;
+/* GPIO interrupt deliveries in a row before the simulation gives up on a storm */
+static constexpr uint32 SIM_IRQ_STORM = 64;
+static constexpr uint64 SIM_OSC_RATE = 54000000;
+
+static uint32 cprman_regs[CPRMAN_SIZE / sizeof(uint32)];
+static uint32 aux_regs[AUX_SIZE / sizeof(uint32)];
+static uint32 gpio_regs[GPIO_SIZE / sizeof(uint32)];
+
+static struct {
+    uint32 fifo[SIM_MBOX_FIFO_DEPTH];
+    uint32 head;
+    uint32 count;
+    /* mail0_status reads left before the firmware answer shows up */
+    uint32 busy;
+    uint32 latency;
+} mbox;
+
+/* simulated time, every MMIO access and every relax moves it forward */
+static constexpr uint64 SIM_MMIO_NS = 20;
+static constexpr uint64 SIM_RELAX_NS = 10000; /* about a yield to another EC */
+static uint64 sim_now;
+/* CM_LOCK bits that never come up, see Sim::set_pll_stuck() */
+static uint32 pll_stuck;
+/* the firmware refuses every message, see Sim::set_fw_fail() */
+static bool fw_fail;
+
+static uint32 fw_power_state[RPI_POWER_DOMAIN_COUNT + 1];
+static uint32 fw_gpio_state[256];
+
+/* service ECs, by CPU */
+static struct {
+    Sel ec;
+    mword sp;
+} srv[PM_MAX_CPUS];
+
+/* the name service, a UUID names one portal */
+static struct {
+    Uuid uuid;
+    mword entry;
+} names[SIM_MAX_NAMES];
+static uint32 num_names;
+
+/* the GPIO interrupt and the EC Pebble runs its handler on */
+static struct {
+    Sel ec;
+    mword entry;
+} gpio_irq;
+
+static struct {
+    Sel sel;
+    uint64 count;
+} sms[SIM_MAX_SMS];
+static uint32 num_sms;
+
+static mword fw_va;
+static Sel sels = 0x1000;
+static Sim::Stats sim_stats;
+
+alignas(PAGE_SIZE) static uint8 heap[PBL_HEAP_SIZE];
+
+extern "C" mword __ZIP[sizeof(Uuid) / sizeof(mword)];
+mword __ZIP[sizeof(Uuid) / sizeof(mword)];
+
+/* GPIO register offsets, rpi_pinctrl keeps its own copy private */
+enum {
+    SIM_GPSET0 = 0x1c,
+    SIM_GPSET1 = 0x20,
+    SIM_GPCLR0 = 0x28,
+    SIM_GPCLR1 = 0x2c,
+    SIM_GPLEV0 = 0x34,
+    SIM_GPLEV1 = 0x38,
+    SIM_GPEDS0 = 0x40,
+    SIM_GPEDS1 = 0x44,
+    SIM_GPREN0 = 0x4c,
+    SIM_GPFEN0 = 0x58,
+    SIM_GPHEN0 = 0x64,
+    SIM_GPLEN0 = 0x70,
+    SIM_GPAREN0 = 0x7c,
+    SIM_GPAFEN0 = 0x88,
+};
+
+static inline uint32 &
+cm(uint32 reg) {
+    return cprman_regs[reg / sizeof(uint32)];
+}
+
+static inline uint32 &
+gpio(uint32 reg) {
+    return gpio_regs[reg / sizeof(uint32)];
+}
+
+/* CM_*CTL registers are 8-byte aligned, CM_*DIV sit right after them */
+static bool
+is_cm_ctl(uint32 reg) {
+    return ((reg < CM_OSCCOUNT) || (reg >= CM_DSI1ECTL && reg <= CM_EMMC2CTL)) && !(reg & 0x4);
+}
+
+static uint32
+cm_lock(void) {
+    uint32 lock = CM_LOCK_FLOCKB; /* owned by the firmware, always running */
+
+    if (!(cm(CM_PLLA) & CM_PLL_ANARST)) lock |= CM_LOCK_FLOCKA;
+    if (!(cm(CM_PLLC) & CM_PLL_ANARST)) lock |= CM_LOCK_FLOCKC;
+    if (!(cm(CM_PLLD) & CM_PLL_ANARST)) lock |= CM_LOCK_FLOCKD;
+    if (!(cm(CM_PLLH) & CM_PLL_ANARST)) lock |= CM_LOCK_FLOCKH;
+
+    return lock & ~pll_stuck;
+}
+
+static uint32
+cprman_read(uint32 reg) {
+    if (reg == CM_LOCK) return cm_lock();
+    return cm(reg);
+}
+
+static void
+cprman_write(uint32 reg, uint32 val) {
+    /* writes without the password are dropped by the hardware */
+    if ((val & 0xff000000u) != 0x5a000000u) return;
+    val &= 0x00ffffffu;
+
+    if (is_cm_ctl(reg)) {
+        /* the divider settles immediately, BUSY simply follows ENABLE */
+        val &= ~CM_BUSY;
+        if (val & CM_ENABLE) val |= CM_BUSY;
+    }
+
+    cm(reg) = val;
+}
+
+static uint32
+gpio_read(uint32 reg) {
+    return gpio(reg);
+}
+
+/* level detection is continuous, an enabled level sets its GPEDS bit again */
+static void
+gpio_detect_levels(void) {
+    for (uint32 bank = 0; bank < 8; bank += 4) {
+        uint32 lev = gpio(SIM_GPLEV0 + bank);
+        gpio(SIM_GPEDS0 + bank)
+            |= (lev & gpio(SIM_GPHEN0 + bank)) | (~lev & gpio(SIM_GPLEN0 + bank));
+    }
+}
+
+/* the interrupt line stays up while any event is pending, Pebble re-arms it after each run */
+static void
+gpio_raise_irq(void) {
+    for (uint32 n = 0; n < SIM_IRQ_STORM && gpio_irq.entry; n++) {
+        if (!gpio(SIM_GPEDS0) && !gpio(SIM_GPEDS1)) return;
+        sim_stats.gpio_irqs++;
+        reinterpret_cast<mword (*)(Mtd, Pbl::Utcb *)>(gpio_irq.entry)(Mtd(), nullptr);
+    }
+}
+
+static void
+gpio_write(uint32 reg, uint32 val) {
+    switch (reg) {
+    case SIM_GPSET0:
+        gpio(SIM_GPLEV0) |= val;
+        break;
+    case SIM_GPSET1:
+        gpio(SIM_GPLEV1) |= val;
+        break;
+    case SIM_GPCLR0:
+        gpio(SIM_GPLEV0) &= ~val;
+        break;
+    case SIM_GPCLR1:
+        gpio(SIM_GPLEV1) &= ~val;
+        break;
+    case SIM_GPLEV0:
+    case SIM_GPLEV1:
+        break;
+    case SIM_GPEDS0:
+    case SIM_GPEDS1:
+        gpio(reg) &= ~val;
+        gpio_detect_levels();
+        break;
+    case SIM_GPHEN0:
+    case SIM_GPHEN0 + 4:
+    case SIM_GPLEN0:
+    case SIM_GPLEN0 + 4:
+        gpio(reg) = val;
+        gpio_detect_levels();
+        break;
+    default:
+        gpio(reg) = val;
+        break;
+    }
+}
+
+static uint32
+fw_clock_rate(uint32 clock_id) {
+    switch (clock_id) {
+    case BCM2835_MBOX_CLOCK_ID_ARM:
+        return 1500000000u;
+    case BCM2835_MBOX_CLOCK_ID_CORE:
+        return 500000000u;
+    case BCM2835_MBOX_CLOCK_ID_EMMC2:
+        return 100000000u;
+    default:
+        return 0;
+    }
+}
+
+/* answer every tag of a property message in place, like the VPU does */
+static void
+fw_process(uint32 bus_addr) {
+    uint8 *buf = reinterpret_cast<uint8 *>(fw_va + ((bus_addr & ~0xc0000000u) - SIM_FW_PA));
+    struct bcm2835_mbox_hdr *hdr = reinterpret_cast<struct bcm2835_mbox_hdr *>(buf);
+    uint32 off = sizeof(*hdr);
+
+    sim_stats.fw_calls++;
+
+    while (off + sizeof(struct bcm2835_mbox_tag_hdr) <= hdr->buf_size) {
+        struct bcm2835_mbox_tag_hdr *tag
+            = reinterpret_cast<struct bcm2835_mbox_tag_hdr *>(buf + off);
+        uint32 *val = reinterpret_cast<uint32 *>(tag + 1);
+        uint32 resp_len = 0;
+
+        if (tag->tag == 0) break;
+
+        switch (tag->tag) {
+        case BCM2835_MBOX_TAG_SET_POWER_STATE:
+            if (val[0] <= RPI_POWER_DOMAIN_COUNT) fw_power_state[val[0]] = val[1] & 1;
+            val[1] = (val[0] <= RPI_POWER_DOMAIN_COUNT) ? fw_power_state[val[0]] :
+                                                          BCM2835_MBOX_POWER_STATE_RESP_NODEV;
+            resp_len = 8;
+            break;
+        case BCM2835_MBOX_TAG_GET_POWER_STATE:
+            val[1] = (val[0] <= RPI_POWER_DOMAIN_COUNT) ? fw_power_state[val[0]] :
+                                                          BCM2835_MBOX_POWER_STATE_RESP_NODEV;
+            resp_len = 8;
+            break;
+        case BCM2835_MBOX_TAG_GET_CLOCK_RATE:
+            val[1] = fw_clock_rate(val[0]);
+            resp_len = 8;
+            break;
+        case BCM2835_MBOX_TAG_SET_GPIO_STATE:
+            fw_gpio_state[val[0] & 0xff] = val[1];
+            break;
+        default:
+            break;
+        }
+
+        tag->val_len = BCM2835_MBOX_TAG_VAL_LEN_RESPONSE | resp_len;
+        off += static_cast<uint32>(sizeof(*tag)) + ((tag->val_buf_size + 3u) & ~3u);
+    }
+
+    hdr->code = fw_fail ? (BCM2835_MBOX_RESP_CODE_SUCCESS | 1) : BCM2835_MBOX_RESP_CODE_SUCCESS;
+}
+
+static uint32
+mbox_read(uint32 reg) {
+    if (reg == offsetof(struct bcm2835_mbox_regs, read)) {
+        if (mbox.count == 0) return 0;
+        uint32 val = mbox.fifo[mbox.head];
+        mbox.head = (mbox.head + 1) % SIM_MBOX_FIFO_DEPTH;
+        mbox.count--;
+        return val;
+    }
+    if (reg == offsetof(struct bcm2835_mbox_regs, mail0_status)) {
+        if (mbox.busy) {
+            mbox.busy--;
+            return BCM2835_MBOX_STATUS_RD_EMPTY;
+        }
+        return mbox.count ? 0 : BCM2835_MBOX_STATUS_RD_EMPTY;
+    }
+    if (reg == offsetof(struct bcm2835_mbox_regs, mail1_status))
+        return (mbox.count == SIM_MBOX_FIFO_DEPTH) ? BCM2835_MBOX_STATUS_WR_FULL : 0;
+
+    return 0;
+}
+
+static void
+mbox_write(uint32 reg, uint32 val) {
+    if (reg != offsetof(struct bcm2835_mbox_regs, write)) return;
+    if (mbox.count == SIM_MBOX_FIFO_DEPTH) return;
+
+    if (BCM2835_MBOX_UNPACK_CHAN(val) == BCM2835_MBOX_PROP_CHAN)
+        fw_process(BCM2835_MBOX_UNPACK_DATA(val));
+
+    mbox.fifo[(mbox.head + mbox.count) % SIM_MBOX_FIFO_DEPTH] = val;
+    mbox.count++;
+    mbox.busy = mbox.latency;
+}
+
+uint32
+ind(mword addr) {
+    sim_stats.reads++;
+    sim_now += SIM_MMIO_NS;
+
+    if (addr >= CPRMAN_BASE && addr < CPRMAN_BASE + CPRMAN_SIZE)
+        return cprman_read(static_cast<uint32>(addr - CPRMAN_BASE));
+    if (addr >= AUX_BASE && addr < AUX_BASE + AUX_SIZE)
+        return aux_regs[(addr - AUX_BASE) / sizeof(uint32)];
+    if (addr >= MBOX_BASE + SIM_MBOX_OFFSET && addr < MBOX_BASE + MBOX_SIZE)
+        return mbox_read(static_cast<uint32>(addr - MBOX_BASE - SIM_MBOX_OFFSET));
+    if (addr >= GPIO_BASE && addr < GPIO_BASE + GPIO_SIZE)
+        return gpio_read(static_cast<uint32>(addr - GPIO_BASE));
+
+    fprintf(stderr, "sim: read from unmapped address 0x%lx\n", addr);
+    abort();
+}
+
+void
+outd(mword addr, uint32 val) {
+    sim_stats.writes++;
+    sim_now += SIM_MMIO_NS;
+
+    if (addr >= CPRMAN_BASE && addr < CPRMAN_BASE + CPRMAN_SIZE)
+        return cprman_write(static_cast<uint32>(addr - CPRMAN_BASE), val);
+    if (addr >= AUX_BASE && addr < AUX_BASE + AUX_SIZE) {
+        aux_regs[(addr - AUX_BASE) / sizeof(uint32)] = val;
+        return;
+    }
+    if (addr >= MBOX_BASE + SIM_MBOX_OFFSET && addr < MBOX_BASE + MBOX_SIZE)
+        return mbox_write(static_cast<uint32>(addr - MBOX_BASE - SIM_MBOX_OFFSET), val);
+    if (addr >= GPIO_BASE && addr < GPIO_BASE + GPIO_SIZE)
+        return gpio_write(static_cast<uint32>(addr - GPIO_BASE), val);
+
+    fprintf(stderr, "sim: write of 0x%x to unmapped address 0x%lx\n", val, addr);
+    abort();
+}
+
+/* PLLs C and D running at 3GHz (feedback predivider on), PLL A powered down */
+static void
+seed_pll(uint32 cm_reg, uint32 a2w_ctrl, uint32 frac, uint32 ana0, bool running) {
+    if (!running) {
+        cm(cm_reg) = CM_PLL_ANARST;
+        cm(a2w_ctrl) = A2W_PLL_CTRL_PWRDN;
+        return;
+    }
+
+    uint64 div = ((3000000000ull / 2) << A2W_PLL_FRAC_BITS) / SIM_OSC_RATE;
+
+    cm(cm_reg) = 0;
+    cm(a2w_ctrl) = A2W_PLL_CTRL_PRST_DISABLE | (1u << A2W_PLL_CTRL_PDIV_SHIFT)
+                   | static_cast<uint32>(div >> A2W_PLL_FRAC_BITS);
+    cm(frac) = static_cast<uint32>(div) & A2W_PLL_FRAC_MASK;
+    cm(ana0 + 4) = BIT(14);
+}
+
+static void
+seed_clock(uint32 ctl, uint32 div, uint32 src, uint32 int_div, bool enabled) {
+    cm(ctl) = src | (enabled ? (CM_ENABLE | CM_BUSY) : 0);
+    cm(div) = int_div << CM_DIV_FRAC_BITS;
+}
+
+void
+Sim::init(void) {
+    mword size = SIM_IRQ_UTCB + PAGE_SIZE - FW_BASE;
+    void *pages = mmap(reinterpret_cast<void *>(FW_BASE), size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (pages != reinterpret_cast<void *>(FW_BASE)) {
+        fprintf(stderr, "sim: cannot map UTCB/firmware pages at 0x%x\n", FW_BASE);
+        abort();
+    }
+
+    memset(cprman_regs, 0, sizeof(cprman_regs));
+    memset(aux_regs, 0, sizeof(aux_regs));
+    memset(gpio_regs, 0, sizeof(gpio_regs));
+    memset(&mbox, 0, sizeof(mbox));
+    memset(srv, 0, sizeof(srv));
+    memset(&gpio_irq, 0, sizeof(gpio_irq));
+    memset(sms, 0, sizeof(sms));
+    num_sms = 0;
+    pll_stuck = 0;
+
+    seed_pll(CM_PLLA, A2W_PLLA_CTRL, A2W_PLLA_FRAC, A2W_PLLA_ANA0, false);
+    seed_pll(CM_PLLC, A2W_PLLC_CTRL, A2W_PLLC_FRAC, A2W_PLLC_ANA0, true);
+    seed_pll(CM_PLLD, A2W_PLLD_CTRL, A2W_PLLD_FRAC, A2W_PLLD_ANA0, true);
+    seed_pll(CM_PLLH, A2W_PLLH_CTRL, A2W_PLLH_FRAC, A2W_PLLH_ANA0, false);
+
+    cm(A2W_PLLA_CORE) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLA_PER) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLA_DSI0) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLA_CCP2) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLC_CORE0) = 6; /* 500MHz */
+    cm(A2W_PLLC_CORE1) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLC_CORE2) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLC_PER) = 6;
+    cm(A2W_PLLD_CORE) = 5; /* 600MHz */
+    cm(A2W_PLLD_PER) = 4;  /* 750MHz */
+    cm(A2W_PLLD_DSI0) = A2W_PLL_CHANNEL_DISABLE;
+    cm(A2W_PLLD_DSI1) = A2W_PLL_CHANNEL_DISABLE;
+
+    seed_clock(CM_VPUCTL, CM_VPUDIV, CM_SRC_PLLC_CORE0, 1, true);
+    seed_clock(CM_V3DCTL, CM_V3DDIV, CM_SRC_PLLC_CORE0, 2, true);
+    seed_clock(CM_H264CTL, CM_H264DIV, CM_SRC_PLLC_CORE0, 2, false);
+    seed_clock(CM_ISPCTL, CM_ISPDIV, CM_SRC_PLLC_CORE0, 2, false);
+    seed_clock(CM_EMMCCTL, CM_EMMCDIV, CM_SRC_PLLD_PER, 3, true);
+    seed_clock(CM_EMMC2CTL, CM_EMMC2DIV, CM_SRC_PLLD_PER, 4, true);
+    seed_clock(CM_UARTCTL, CM_UARTDIV, CM_SRC_PLLD_PER, 16, true);
+    seed_clock(CM_TIMERCTL, CM_TIMERDIV, CM_SRC_OSC, 54, true);
+    seed_clock(CM_PWMCTL, CM_PWMDIV, CM_SRC_OSC, 2, false);
+    cm(CM_PERIICTL) = CM_GATE;
+
+    /* ACT LED (GPIO 42) is an output */
+    gpio(0x10) = 1u << 6;
+
+    for (uint32 i = 0; i <= RPI_POWER_DOMAIN_COUNT; i++)
+        fw_power_state[i] = 0;
+    fw_power_state[RPI_POWER_DOMAIN_USB] = 1;
+    fw_power_state[RPI_POWER_DOMAIN_ARM] = 1;
+
+    reset_stats();
+}
+
+mword
+Sim::utcb(Cpu cpu) {
+    return SIM_UTCB_BASE + cpu * PAGE_SIZE;
+}
+
+mword
+Sim::lookup(const Uuid &uuid) {
+    for (uint32 i = 0; i < num_names; i++)
+        if (names[i].uuid.lo == uuid.lo && names[i].uuid.hi == uuid.hi) return names[i].entry;
+    return 0;
+}
+
+mword
+Sim::portal(Cpu cpu, mword words) {
+    const Uuid &svc = *reinterpret_cast<Uuid *>(__ZIP);
+    mword entry = lookup(drv_ipc::cpu_uuid(svc, cpu));
+    if (!entry) {
+        fprintf(stderr, "sim: no portal registered for CPU %lu\n", cpu);
+        abort();
+    }
+    mword ret = reinterpret_cast<mword (*)(Mtd, Pbl::Utcb *)>(entry)(Mtd(words), nullptr);
+    /* the call may have re-enabled a level that is still asserted */
+    gpio_raise_irq();
+    return ret;
+}
+
+void
+Sim::set_gpio_input(uint32 pin, bool high) {
+    uint32 bank = (pin / 32) * 4, bit = 1u << (pin % 32);
+    bool was = (gpio(SIM_GPLEV0 + bank) & bit) != 0;
+
+    if (high)
+        gpio(SIM_GPLEV0 + bank) |= bit;
+    else
+        gpio(SIM_GPLEV0 + bank) &= ~bit;
+
+    /* the synchronous and asynchronous detectors latch the same way here */
+    uint32 detect = 0;
+    if (!was && high) detect |= gpio(SIM_GPREN0 + bank) | gpio(SIM_GPAREN0 + bank);
+    if (was && !high) detect |= gpio(SIM_GPFEN0 + bank) | gpio(SIM_GPAFEN0 + bank);
+    detect |= high ? gpio(SIM_GPHEN0 + bank) : gpio(SIM_GPLEN0 + bank);
+    if (!(detect & bit)) return;
+
+    gpio(SIM_GPEDS0 + bank) |= bit;
+    gpio_raise_irq();
+}
+
+bool
+Sim::sm_try_down(Sel sm) {
+    for (uint32 i = 0; i < num_sms; i++) {
+        if (sms[i].sel != sm) continue;
+        if (!sms[i].count) return false;
+        sms[i].count--;
+        return true;
+    }
+    return false;
+}
+
+Sim::Stats &
+Sim::stats(void) {
+    return sim_stats;
+}
+
+void
+Sim::reset_stats(void) {
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+void
+Sim::set_fw_latency(uint32 polls) {
+    mbox.latency = polls;
+}
+
+void
+Sim::set_fw_fail(bool fail) {
+    fw_fail = fail;
+}
+
+void
+Sim::set_pll_stuck(uint32 lock_mask) {
+    pll_stuck = lock_mask;
+}
+
+void
+Sim::advance(uint64 ns) {
+    sim_now += ns;
+}
+
+/* time source of the driver's bounded waits, see pm.hpp */
+uint64
+Pm::ticks(void) {
+    return sim_now;
+}
+
+uint64
+Pm::tick_freq(void) {
+    return 1000000000ull;
+}
+
+void
+Pm::relax(void) {
+    sim_now += SIM_RELAX_NS;
+}
+
+/* Pebble runtime */
+
+mword
+Pbl::heap_start() {
+    return reinterpret_cast<mword>(heap);
+}
+
+Sel
+Pbl::sels_base() {
+    return sels;
+}
+
+Errno
+Pbl::create_local_ec(Utcb *, Sel ec, Cpu cpu, mword utcb_va, mword sp, Sel) {
+    mword heap_va = reinterpret_cast<mword>(heap);
+
+    if (cpu >= PM_MAX_CPUS || srv[cpu].ec) return Errno::EINVAL;
+    if (utcb_va != Sim::utcb(cpu)) return Errno::EINVAL;
+    /* every EC needs a stack of its own inside the heap */
+    if (sp < heap_va + SRV_STACK_SIZE || sp > heap_va + sizeof(heap)) return Errno::EINVAL;
+    for (uint32 i = 0; i < PM_MAX_CPUS; i++)
+        if (srv[i].ec && sp < srv[i].sp + SRV_STACK_SIZE && srv[i].sp < sp + SRV_STACK_SIZE)
+            return Errno::EINVAL;
+
+    srv[cpu].ec = ec;
+    srv[cpu].sp = sp;
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::acquire_resource(Utcb *, const char *, res_type, mword, Sel &, mword, bool) {
+    /* the driver keeps using its requested address, ind/outd decode it */
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::dma_mmap(Utcb *, mword &va, mword size, mword, bool, mword &pa) {
+    if (va == STATUS_BASE && size <= STATUS_SIZE) {
+        pa = SIM_STATUS_PA;
+        return Errno::ENONE;
+    }
+    if (va == EVT_BASE && size <= EVT_SIZE) {
+        pa = SIM_EVT_PA;
+        return Errno::ENONE;
+    }
+    if (va != FW_BASE || size > FW_SIZE) return Errno::EINVAL;
+    fw_va = va;
+    pa = SIM_FW_PA;
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::srv_create(Utcb *, Sel ec, const Uuid &uuid, mword, mword, mword entry) {
+    bool found = false;
+    for (uint32 i = 0; i < PM_MAX_CPUS; i++)
+        found |= (srv[i].ec == ec);
+    if (!found) return Errno::EINVAL;
+
+    if (Sim::lookup(uuid)) return Errno::EBUSY;
+    if (num_names == SIM_MAX_NAMES) return Errno::ENOMEM;
+    names[num_names++] = {uuid, entry};
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::irq_attach(Utcb *, Sel, Sel ec, Cpu cpu, mword utcb_va, mword sp, mword entry) {
+    mword heap_va = reinterpret_cast<mword>(heap);
+
+    if (cpu >= PM_MAX_CPUS || gpio_irq.ec || utcb_va != SIM_IRQ_UTCB) return Errno::EINVAL;
+    if (sp < heap_va + SRV_STACK_SIZE || sp > heap_va + sizeof(heap)) return Errno::EINVAL;
+    for (uint32 i = 0; i < PM_MAX_CPUS; i++)
+        if (srv[i].ec && sp < srv[i].sp + SRV_STACK_SIZE && srv[i].sp < sp + SRV_STACK_SIZE)
+            return Errno::EINVAL;
+
+    gpio_irq.ec = ec;
+    gpio_irq.entry = entry;
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::sm_create(Utcb *, Sel sm, mword count) {
+    if (num_sms == SIM_MAX_SMS) return Errno::ENOMEM;
+    sms[num_sms++] = {sm, count};
+    return Errno::ENONE;
+}
+
+Errno
+Pbl::API::sm_up(Sel sm) {
+    for (uint32 i = 0; i < num_sms; i++) {
+        if (sms[i].sel != sm) continue;
+        sms[i].count++;
+        return Errno::ENONE;
+    }
+    return Errno::EINVAL;
+}
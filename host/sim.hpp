@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Simulated BCM2711 register file used by the host build. It models enough of
+ * CPRMAN, AUX, GPIO and the VideoCore property mailbox for the driver to run
+ * unmodified: the CM password, PLL lock status, CM_BUSY, GPSET/GPCLR/GPEDS
+ * semantics and a synchronous firmware that answers property messages. Time
+ * is simulated too, so bounded waits on a stuck PLL expire deterministically.
+ * The GPIO interrupt is level triggered like the real one: it is delivered
+ * again for as long as GPEDS has bits set, a storm is cut off after a few
+ * dozen deliveries and shows in Stats::gpio_irqs.
+ */
+
+#pragma once
+#include <pebble/types.hpp>
+
+namespace Sim {
+
+struct Stats {
+    uint64 reads;
+    uint64 writes;
+    uint64 fw_calls;
+    uint64 gpio_irqs;
+};
+
+/* map the UTCB and firmware pages and seed the registers with a booted state */
+void init(void);
+
+/* address the driver expects the UTCB of the EC serving cpu at, see main.cpp */
+mword utcb(Cpu cpu = 0);
+
+/*
+ * call the portal pbl_main registered under drv_ipc::cpu_uuid() of cpu, as a client on
+ * that core would, with words the untyped word count of its Mtd, 0 as for a client that
+ * sends no count
+ */
+mword portal(Cpu cpu = 0, mword words = PAGE_SIZE / sizeof(mword));
+
+/* entry of the portal registered under uuid, 0 if there is none */
+mword lookup(const Uuid &uuid);
+
+Stats &stats(void);
+
+void reset_stats(void);
+
+/* firmware answers only after this many mail0_status reads, 0 by default */
+void set_fw_latency(uint32 polls);
+
+/* the firmware answers every message with an error until cleared */
+void set_fw_fail(bool fail);
+
+/* PLLs whose CM_LOCK bit in lock_mask never comes up, 0 to heal them */
+void set_pll_stuck(uint32 lock_mask);
+
+/* let simulated time pass, as a client idling between calls would */
+void advance(uint64 ns);
+
+/* drive an input pad; a detected event raises the GPIO interrupt right away */
+void set_gpio_input(uint32 pin, bool high);
+
+/* what a client blocked on the semaphore would do, false if it would block */
+bool sm_try_down(Sel sm);
+
+}
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2020 BedRock Systems, Inc.
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+/**
+ * Functional checks of the PM service against the simulated register file.
+ * Like the benchmarks every call goes through the portal handler in main.cpp;
+ * each case leaves the driver in the state it found it in, they share one
+ * driver instance and run in order. Exits non-zero if any check failed.
+ */
+
+#include <new>
+#include <rpi4.hpp>
+#include <sim.hpp>
+#include <stdio.h>
+
+struct test {
+    const char *name;
+    void (*run)(void);
+};
+
+extern "C" mword __ZIP[];
+
+static Pbl::Utcb boot_utcb;
+static uint32 checks, failures;
+
+/* words the portal returned for the last call */
+static mword reply_words;
+
+static void
+check(bool ok, const char *expr, const char *file, int line) {
+    checks++;
+    if (ok) return;
+    failures++;
+    printf("  %s:%d: check failed: %s\n", file, line, expr);
+}
+
+#define CHECK(_expr_) check((_expr_), #_expr_, __FILE__, __LINE__)
+
+/* through the portal of cpu, the reply stays in that UTCB */
+template<typename ARGS, typename... T>
+static Errno
+call_on(Cpu cpu, T... args) {
+    ARGS *msg = new (reinterpret_cast<void *>(Sim::utcb(cpu))) ARGS(args...);
+    reply_words = Sim::portal(cpu, msg->size());
+    return reinterpret_cast<drv_ipc::ret *>(Sim::utcb(cpu))->errno;
+}
+
+template<typename ARGS, typename... T>
+static Errno
+call(T... args) {
+    return call_on<ARGS>(0, args...);
+}
+
+/* the reply of the last call on CPU 0 */
+template<typename RET>
+static RET *
+reply(void) {
+    return reinterpret_cast<RET *>(Sim::utcb());
+}
+
+static const drv_ipc::status_page *
+page(void) {
+    return reinterpret_cast<const drv_ipc::status_page *>(STATUS_BASE);
+}
+
+static bool
+clk_enabled(uint8 clk) {
+    return call<drv_ipc::clk_is_enabled_args>(clk) == Errno::ENONE
+           && reply<drv_ipc::clk_is_enabled_ret>()->enabled;
+}
+
+static uint64
+clk_rate(uint8 clk) {
+    if (call<drv_ipc::clk_get_rate_args>(clk) != Errno::ENONE) return 0;
+    return reply<drv_ipc::clk_get_rate_ret>()->rate;
+}
+
+/* gated at boot, fed by PLLC_CORE0 which runs anyway */
+static void
+clk_refcount(void) {
+    CHECK(!clk_enabled(BCM2835_CLOCK_H264));
+    CHECK(call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_H264) == Errno::ENONE);
+    CHECK(call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_H264) == Errno::ENONE);
+    CHECK(clk_enabled(BCM2835_CLOCK_H264));
+
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_H264) == Errno::ENONE);
+    CHECK(clk_enabled(BCM2835_CLOCK_H264));
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_H264) == Errno::ENONE);
+    CHECK(!clk_enabled(BCM2835_CLOCK_H264));
+
+    CHECK(call<drv_ipc::clk_enable_args>(200u) == Errno::EINVAL);
+}
+
+/* only the first enable and the last disable reach the firmware */
+static void
+node_refcount(void) {
+    Sim::Stats before = Sim::stats();
+    CHECK(call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_V3D) == Errno::ENONE);
+    CHECK(Sim::stats().fw_calls - before.fw_calls == 1);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_V3D] == 1);
+
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D) == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_V3D] == 1);
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_V3D) == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_V3D] == 0);
+    CHECK(Sim::stats().fw_calls - before.fw_calls == 2);
+
+    CHECK(call<drv_ipc::node_get_max_args>() == Errno::ENONE);
+    CHECK(reply<drv_ipc::node_get_max_ret>()->max_id == drv_ipc::NODE_DEVICE_END);
+}
+
+/* a device node takes its domain and clock with it */
+static void
+device_node(void) {
+    CHECK(call<drv_ipc::node_enable_args>(drv_ipc::NODE_H264) == Errno::ENONE);
+    CHECK(page()->node_state[drv_ipc::NODE_H264] == 1);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_H264] == 1);
+    CHECK(clk_enabled(BCM2835_CLOCK_H264));
+
+    CHECK(call<drv_ipc::node_disable_args>(drv_ipc::NODE_H264) == Errno::ENONE);
+    CHECK(page()->node_state[drv_ipc::NODE_H264] == 0);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_H264] == 0);
+    CHECK(!clk_enabled(BCM2835_CLOCK_H264));
+
+    /* V3D asks for 500MHz: only while nobody else holds the clock, and not past the node */
+    uint64 boot = clk_rate(BCM2835_CLOCK_V3D);
+    CHECK(call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_V3D) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D) == Errno::EBUSY);
+    CHECK(page()->node_state[drv_ipc::NODE_V3D] == 0);
+    CHECK(clk_rate(BCM2835_CLOCK_V3D) == boot);
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_V3D) == Errno::ENONE);
+
+    CHECK(call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D) == Errno::ENONE);
+    uint64 rate = clk_rate(BCM2835_CLOCK_V3D);
+    CHECK(rate != boot && rate <= 500000000ull && rate > 499000000ull);
+    CHECK(call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D) == Errno::ENONE);
+    CHECK(clk_rate(BCM2835_CLOCK_V3D) == boot);
+    CHECK(!clk_enabled(BCM2835_CLOCK_V3D));
+
+    /* a holder already at the rate CLK_SET_RATE lands on is no conflict, nor retuned back */
+    CHECK(call<drv_ipc::clk_set_rate_args>(BCM2835_CLOCK_V3D, 500000000ull) == Errno::ENONE);
+    CHECK(call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_V3D) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_enable_args>(drv_ipc::NODE_V3D) == Errno::ENONE);
+    CHECK(clk_rate(BCM2835_CLOCK_V3D) == rate);
+    CHECK(call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D) == Errno::ENONE);
+    CHECK(clk_rate(BCM2835_CLOCK_V3D) == rate);
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_V3D) == Errno::ENONE);
+    CHECK(call<drv_ipc::clk_set_rate_args>(BCM2835_CLOCK_V3D, boot) == Errno::ENONE);
+    CHECK(clk_rate(BCM2835_CLOCK_V3D) == boot);
+
+    /* more disables than enables */
+    CHECK(call<drv_ipc::node_disable_args>(drv_ipc::NODE_V3D) == Errno::EINVAL);
+}
+
+/* entries after a failing one are left alone */
+static void
+clk_batch_stop(void) {
+    drv_ipc::clk_batch_entry clks[] = {
+        {BCM2835_CLOCK_H264, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+        {200, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+        {BCM2835_CLOCK_ISP, drv_ipc::CLK_OP_ENABLE, 0, 0, 0},
+    };
+
+    CHECK(call<drv_ipc::clk_batch_args_ipc>(clks, 3u) == Errno::EINVAL);
+    drv_ipc::clk_batch_ret_ipc *ret = reply<drv_ipc::clk_batch_ret_ipc>();
+    CHECK(ret->num_done == 1);
+    CHECK(ret->clks[0].err == Errno::ENONE);
+    CHECK(ret->clks[1].err == Errno::EINVAL);
+    /* the failing entry is part of the reply, the untouched one is not */
+    CHECK(reply_words == drv_ipc::words(sizeof(*ret) + 2 * sizeof(ret->clks[0])));
+    CHECK(clk_enabled(BCM2835_CLOCK_H264));
+    CHECK(!clk_enabled(BCM2835_CLOCK_ISP));
+
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_H264) == Errno::ENONE);
+}
+
+/* the firmware keeps the transition in flight for a while */
+static void
+split_phase(void) {
+    Sim::set_fw_latency(16);
+    CHECK(call<drv_ipc::node_set_async_args>(RPI_POWER_DOMAIN_ISP, 1u) == Errno::ENONE);
+    uint32 token = reply<drv_ipc::node_set_async_ret>()->token;
+    CHECK(token != drv_ipc::NODE_TOKEN_DONE);
+
+    /* other requests for the domain wait for the outcome */
+    CHECK(call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_ISP) == Errno::EBUSY);
+
+    Errno err;
+    uint32 polls = 0;
+    while ((err = call<drv_ipc::node_complete_args>(token)) == Errno::EBUSY)
+        polls++;
+    CHECK(polls > 0);
+    CHECK(err == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 1);
+    CHECK(call<drv_ipc::node_complete_args>(token) == Errno::EINVAL);
+    Sim::set_fw_latency(0);
+
+    /* nothing for the firmware to do, the token is done already */
+    CHECK(call<drv_ipc::node_set_async_args>(RPI_POWER_DOMAIN_ISP, 1u) == Errno::ENONE);
+    CHECK(reply<drv_ipc::node_set_async_ret>()->token == drv_ipc::NODE_TOKEN_DONE);
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_ISP) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_ISP) == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 0);
+
+    /* a failed posted disable leaves the idle timer it stopped running */
+    static constexpr uint64 IDLE_US = 1000;
+    CHECK(call<drv_ipc::autosuspend_args>(drv_ipc::AUTOSUSPEND_NODE, RPI_POWER_DOMAIN_ISP, IDLE_US)
+          == Errno::ENONE);
+    CHECK(call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_ISP) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_ISP) == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 1);
+
+    Sim::set_fw_fail(true);
+    CHECK(call<drv_ipc::node_set_async_args>(RPI_POWER_DOMAIN_ISP, 0u) == Errno::ENONE);
+    token = reply<drv_ipc::node_set_async_ret>()->token;
+    CHECK(token != drv_ipc::NODE_TOKEN_DONE);
+    CHECK(call<drv_ipc::node_complete_args>(token) == Errno::ENOTSUP);
+    Sim::set_fw_fail(false);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 1);
+
+    /* the next release, or a new delay, gates it */
+    Sim::advance(2 * IDLE_US * 1000);
+    CHECK(call<drv_ipc::node_get_max_args>() == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 1);
+    CHECK(call<drv_ipc::autosuspend_args>(drv_ipc::AUTOSUSPEND_NODE, RPI_POWER_DOMAIN_ISP, 0ull)
+          == Errno::ENONE);
+    CHECK(page()->node_state[RPI_POWER_DOMAIN_ISP] == 0);
+}
+
+/* posted transitions leave a slot to synchronous calls and expire if nobody collects them */
+static void
+posted_limits(void) {
+    static const uint32 pds[] = {RPI_POWER_DOMAIN_I2C0, RPI_POWER_DOMAIN_I2C1,
+                                 RPI_POWER_DOMAIN_I2C2, RPI_POWER_DOMAIN_VIDEO_SCALER,
+                                 RPI_POWER_DOMAIN_VPU1, RPI_POWER_DOMAIN_HDMI,
+                                 RPI_POWER_DOMAIN_VEC,  RPI_POWER_DOMAIN_JPEG};
+    static_assert(sizeof(pds) / sizeof(pds[0]) == RPI_FW_MAX_SLOTS, "one per firmware slot");
+    uint32 tokens[RPI_FW_MAX_SLOTS], posted = 0;
+    Errno err = Errno::ENONE;
+
+    Sim::set_fw_latency(16);
+    for (uint32 pd : pds) {
+        err = call<drv_ipc::node_set_async_args>(pd, 1u);
+        if (err == Errno::ENONE) tokens[posted++] = reply<drv_ipc::node_set_async_ret>()->token;
+    }
+    CHECK(posted == RPI_FW_MAX_SLOTS - 1);
+    CHECK(err == Errno::EBUSY);
+
+    CHECK(call<drv_ipc::node_enable_args>(RPI_POWER_DOMAIN_JPEG) == Errno::ENONE);
+    CHECK(call<drv_ipc::node_disable_args>(RPI_POWER_DOMAIN_JPEG) == Errno::ENONE);
+
+    /* a token is only good on the portal that returned it */
+    CHECK(call_on<drv_ipc::node_complete_args>(1, tokens[0]) == Errno::EINVAL);
+
+    /* nobody collected, the next posted request does and the domains take requests again */
+    Sim::advance(drv_ipc::NODE_TOKEN_TTL_NS);
+    CHECK(call<drv_ipc::node_set_async_args>(RPI_POWER_DOMAIN_JPEG, 0u) == Errno::ENONE);
+    CHECK(reply<drv_ipc::node_set_async_ret>()->token == drv_ipc::NODE_TOKEN_DONE);
+    for (uint32 i = 0; i < posted; i++) {
+        CHECK(page()->node_state[pds[i]] == 1);
+        CHECK(call<drv_ipc::node_complete_args>(tokens[i]) == Errno::EINVAL);
+        CHECK(call<drv_ipc::node_disable_args>(pds[i]) == Errno::ENONE);
+        CHECK(page()->node_state[pds[i]] == 0);
+    }
+    Sim::set_fw_latency(0);
+}
+
+static uint64
+round_rate(uint8 clk, uint64 rate) {
+    if (call<drv_ipc::clk_round_rate_args>(clk, rate) != Errno::ENONE) return 0;
+    return reply<drv_ipc::clk_round_rate_ret>()->rate;
+}
+
+/*
+ * set_rate lands where round_rate said, close to the target and in the
+ * described range; asking for the current rate keeps it
+ */
+static void
+rate_planning(void) {
+    uint64 boot = clk_rate(BCM2711_CLOCK_EMMC2);
+    uint64 targets[] = {boot, 100000000ull, 50000000ull, 33000000ull, boot};
+
+    for (uint64 target : targets) {
+        uint64 rounded = round_rate(BCM2711_CLOCK_EMMC2, target);
+        CHECK(rounded <= target && target - rounded < target / 1000);
+        CHECK(call<drv_ipc::clk_set_rate_args>(BCM2711_CLOCK_EMMC2, target) == Errno::ENONE);
+        CHECK(clk_rate(BCM2711_CLOCK_EMMC2) == rounded);
+    }
+    CHECK(clk_rate(BCM2711_CLOCK_EMMC2) == boot);
+
+    CHECK(call<drv_ipc::clk_describe_rate_args>(BCM2711_CLOCK_EMMC2) == Errno::ENONE);
+    Pm::clk_desc desc = reply<drv_ipc::clk_describe_rate_ret>()->desc;
+    CHECK(desc.min <= boot && boot <= desc.max);
+
+    /* ids are 64 bits on the wire, none beyond the clock table may alias a clock */
+    CHECK(call<drv_ipc::clk_round_rate_args>(256 + BCM2711_CLOCK_EMMC2, boot) == Errno::EINVAL);
+    CHECK(call<drv_ipc::clk_round_rate_args>(BCM2711_CLOCK_TOTAL, boot) == Errno::EINVAL);
+}
+
+/* the page agrees with the portal once the driver is idle */
+static void
+status_snapshot(void) {
+    const drv_ipc::status_page *p = page();
+
+    CHECK(call<drv_ipc::clk_enable_args>(BCM2835_CLOCK_PWM) == Errno::ENONE);
+    CHECK(p->magic == drv_ipc::status_page::MAGIC);
+    CHECK(!(p->seq & 1));
+    for (uint8 id = 0; id < p->num_clks; id++) {
+        if (call<drv_ipc::clk_get_rate_args>(id) != Errno::ENONE) continue;
+        CHECK(p->clks[id].rate == reply<drv_ipc::clk_get_rate_ret>()->rate);
+        CHECK(p->clks[id].enabled == clk_enabled(id));
+    }
+
+    uint32 seq = p->seq;
+    CHECK(call<drv_ipc::clk_disable_args>(BCM2835_CLOCK_PWM) == Errno::ENONE);
+    CHECK(p->seq != seq && !(p->seq & 1));
+    CHECK(!p->clks[BCM2835_CLOCK_PWM].enabled);
+}
+
+/* an edge on a subscribed pin lands in the ring and ups the semaphore once */
+static void
+gpio_ring(void) {
+    static constexpr uint32 PIN = 17;
+    Pm::Pin pin = {PIN, Pm::iotrig::EDGE_RISE};
+
+    Sim::set_gpio_input(PIN, false);
+    CHECK(call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_SET_GPIOTRIG), &pin, 1u)
+          == Errno::ENONE);
+    CHECK(call<drv_ipc::gpio_evt_subscribe_args>(1ull << PIN) == Errno::ENONE);
+    drv_ipc::gpio_evt_subscribe_ret sub = *reply<drv_ipc::gpio_evt_subscribe_ret>();
+    drv_ipc::gpio_evt_ring *ring
+        = reinterpret_cast<drv_ipc::gpio_evt_ring *>(EVT_BASE + sub.client * PAGE_SIZE);
+
+    Sim::set_gpio_input(PIN, true);
+    CHECK(Sim::sm_try_down(sub.sm));
+    CHECK(!Sim::sm_try_down(sub.sm));
+    CHECK(ring->head - ring->tail == 1);
+    CHECK(ring->evts[ring->tail % drv_ipc::gpio_evt_ring::SIZE].pin == PIN);
+    CHECK(ring->evts[ring->tail % drv_ipc::gpio_evt_ring::SIZE].trig == Pm::iotrig::EDGE_RISE);
+    ring->tail = ring->head;
+
+    /* no edge, no event */
+    Sim::set_gpio_input(PIN, false);
+    CHECK(ring->head == ring->tail);
+
+    /* the pin and the slot belong to the subscriber */
+    CHECK(call_on<drv_ipc::gpio_evt_subscribe_args>(1, 1ull << PIN) == Errno::EBUSY);
+    CHECK(call_on<drv_ipc::gpio_evt_unsubscribe_args>(1, sub.client) == Errno::EPERM);
+
+    CHECK(call<drv_ipc::gpio_evt_unsubscribe_args>(sub.client) == Errno::ENONE);
+    CHECK(call<drv_ipc::gpio_evt_unsubscribe_args>(sub.client) == Errno::ENOENT);
+    pin.val = Pm::iotrig::EDGE_RISE | Pm::iotrig::TRIG_CLR;
+    CHECK(call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_SET_GPIOTRIG), &pin, 1u)
+          == Errno::ENONE);
+}
+
+static Errno
+set_trigger(uint32 pin, uint32 trig) {
+    Pm::Pin p = {static_cast<uint8>(pin), trig};
+    return call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_SET_GPIOTRIG), &p, 1u);
+}
+
+static uint32
+gpio_event(uint32 pin) {
+    Pm::Pin p = {static_cast<uint8>(pin), 0};
+    if (call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_GET_GPIOEVT), &p, 1u)
+        != Errno::ENONE)
+        return ~0u;
+    return reply<drv_ipc::pinctrl_ret_ipc>()->pins[0].val;
+}
+
+static Errno
+clr_gpio_event(uint32 pin) {
+    Pm::Pin p = {static_cast<uint8>(pin), 0};
+    return call<drv_ipc::pinctrl_args_ipc>(static_cast<uint8>(PM_CLR_GPIOEVT), &p, 1u);
+}
+
+/* a held level raises one interrupt per event handled, not a storm */
+static void
+gpio_level(void) {
+    static constexpr uint32 PIN = 18, POLL_PIN = 19;
+
+    Sim::set_gpio_input(PIN, false);
+    Sim::set_gpio_input(POLL_PIN, false);
+    CHECK(set_trigger(PIN, Pm::iotrig::LEVEL_HIGH) == Errno::ENONE);
+    CHECK(set_trigger(POLL_PIN, Pm::iotrig::LEVEL_HIGH) == Errno::ENONE);
+    CHECK(call<drv_ipc::gpio_evt_subscribe_args>(1ull << PIN) == Errno::ENONE);
+    drv_ipc::gpio_evt_subscribe_ret sub = *reply<drv_ipc::gpio_evt_subscribe_ret>();
+    drv_ipc::gpio_evt_ring *ring
+        = reinterpret_cast<drv_ipc::gpio_evt_ring *>(EVT_BASE + sub.client * PAGE_SIZE);
+
+    uint64 irqs = Sim::stats().gpio_irqs;
+    Sim::set_gpio_input(PIN, true);
+    CHECK(Sim::stats().gpio_irqs - irqs == 1);
+    CHECK(ring->head - ring->tail == 1);
+    CHECK(ring->evts[ring->tail % drv_ipc::gpio_evt_ring::SIZE].trig == Pm::iotrig::LEVEL_HIGH);
+    CHECK(ring->dropped == 0);
+
+    /* consumed and the level still high: the next pin call re-enables it and it fires again */
+    ring->tail = ring->head;
+    irqs = Sim::stats().gpio_irqs;
+    CHECK(call<drv_ipc::node_get_max_args>() == Errno::ENONE);
+    CHECK(Sim::stats().gpio_irqs == irqs);
+    CHECK(gpio_event(POLL_PIN) == 0);
+    CHECK(Sim::stats().gpio_irqs - irqs == 1);
+    CHECK(ring->head - ring->tail == 1);
+
+    /* released before the client got to it, nothing more comes */
+    Sim::set_gpio_input(PIN, false);
+    ring->tail = ring->head;
+    CHECK(gpio_event(POLL_PIN) == 0);
+    CHECK(ring->head == ring->tail);
+
+    /* without a subscriber the event waits for PM_CLR_GPIOEVT */
+    irqs = Sim::stats().gpio_irqs;
+    Sim::set_gpio_input(POLL_PIN, true);
+    CHECK(Sim::stats().gpio_irqs - irqs == 1);
+    CHECK(gpio_event(POLL_PIN) == 1);
+    CHECK(clr_gpio_event(POLL_PIN) == Errno::ENONE);
+    CHECK(gpio_event(POLL_PIN) == 1);
+    CHECK(Sim::stats().gpio_irqs - irqs == 2);
+    Sim::set_gpio_input(POLL_PIN, false);
+    CHECK(clr_gpio_event(POLL_PIN) == Errno::ENONE);
+    CHECK(gpio_event(POLL_PIN) == 0);
+
+    CHECK(call<drv_ipc::gpio_evt_unsubscribe_args>(sub.client) == Errno::ENONE);
+    CHECK(set_trigger(PIN, Pm::iotrig::LEVEL_HIGH | Pm::iotrig::TRIG_CLR) == Errno::ENONE);
+    CHECK(set_trigger(POLL_PIN, Pm::iotrig::LEVEL_HIGH | Pm::iotrig::TRIG_CLR) == Errno::ENONE);
+}
+
+/* a message longer than the client sent is refused, one that sends no count is not */
+static void
+ipc_bounds(void) {
+    new (reinterpret_cast<void *>(Sim::utcb())) drv_ipc::clk_set_rate_args(BCM2711_CLOCK_EMMC2, 1);
+    Sim::portal(0, 1);
+    CHECK(reply<drv_ipc::ret>()->errno == Errno::EINVAL);
+
+    new (reinterpret_cast<void *>(Sim::utcb())) drv_ipc::clk_get_rate_args(BCM2711_CLOCK_EMMC2);
+    Sim::portal(0, 0);
+    CHECK(reply<drv_ipc::ret>()->errno == Errno::ENONE);
+
+    Pm::Pin pin = {0, 0};
+    drv_ipc::pinctrl_args_ipc *msg = new (reinterpret_cast<void *>(Sim::utcb()))
+        drv_ipc::pinctrl_args_ipc(static_cast<uint8>(PM_GET_GPIO), &pin, 1u);
+    msg->num_pins = drv_ipc::PINCTRL_MAX_PINS + 1;
+    Sim::portal(0);
+    CHECK(reply<drv_ipc::ret>()->errno == Errno::EINVAL);
+}
+
+/* the boot CPU keeps the service name, every CPU has a portal under a name of its own */
+static void
+cpu_portals(void) {
+    const Uuid &svc = *reinterpret_cast<Uuid *>(__ZIP);
+
+    CHECK(Sim::lookup(svc) != 0);
+    CHECK(Sim::lookup(svc) == Sim::lookup(drv_ipc::cpu_uuid(svc, 0)));
+    for (Cpu c = 0; c < PM_MAX_CPUS; c++) {
+        CHECK(Sim::lookup(drv_ipc::cpu_uuid(svc, c)) != 0);
+        for (Cpu o = 0; o < c; o++)
+            CHECK(Sim::lookup(drv_ipc::cpu_uuid(svc, c)) != Sim::lookup(drv_ipc::cpu_uuid(svc, o)));
+    }
+
+    CHECK(call<drv_ipc::stats_get_args>(0u) == Errno::ENONE);
+    CHECK(reply<drv_ipc::stats_get_ret>()->portal_cpus == (1ull << PM_MAX_CPUS) - 1);
+}
+
+static const test tests[] = {
+    {"per-CPU portals", cpu_portals},
+    {"clock enable refcount", clk_refcount},
+    {"power domain refcount", node_refcount},
+    {"device node", device_node},
+    {"CLK_BATCH stops at the first error", clk_batch_stop},
+    {"split-phase node transition", split_phase},
+    {"posted transition limits", posted_limits},
+    {"rate planning", rate_planning},
+    {"status page snapshot", status_snapshot},
+    {"GPIO event ring", gpio_ring},
+    {"GPIO level trigger", gpio_level},
+    {"IPC message bounds", ipc_bounds},
+};
+
+int
+main(void) {
+    Sim::init();
+    pbl_main(&boot_utcb, 0);
+
+    uint32 failed = 0;
+    for (const test &t : tests) {
+        uint32 before = failures;
+        t.run();
+        printf("%-4s %s\n", (failures == before) ? "ok" : "FAIL", t.name);
+        if (failures != before) failed++;
+    }
+
+    printf("%u of %u tests failed, %u checks\n", failed,
+           static_cast<uint32>(sizeof(tests) / sizeof(tests[0])), checks);
+    return failed ? 1 : 0;
+}
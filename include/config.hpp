@@ -11,4 +11,29 @@
 
 #define SRV_STACK_SIZE (0x3FF0)
 
-#define PBL_HEAP_SIZE (SRV_STACK_SIZE)
+/* BCM2711 has four Cortex-A72 cores, each gets its own service EC */
+#define PM_MAX_CPUS 4
+
+/* one stack per service EC plus the GPIO interrupt EC, if there is one */
+#define PBL_HEAP_SIZE (SRV_STACK_SIZE * (PM_MAX_CPUS + PM_GPIO_EVT_RINGS))
+
+/*
+ * Status page. Clients would need the page delegated to them, a physical
+ * address is no use outside the driver, so it is off by default and
+ * STATUS_PAGE fails with ENOTSUP. The host simulation turns it on.
+ */
+#ifndef PM_STATUS_PAGE
+#define PM_STATUS_PAGE 0
+#endif
+
+/*
+ * GPIO event rings. Subscribers need the ring page and the semaphore
+ * delegated to them, which the portal does not do yet, so they are off by
+ * default and GPIO_EVT_SUBSCRIBE fails with ENOTSUP. The GPIO interrupt is
+ * only taken with them, without it PM_GET_GPIOEVT works as it always has.
+ * Builds whose clients share the driver's address space, like the host
+ * simulation, turn them on.
+ */
+#ifndef PM_GPIO_EVT_RINGS
+#define PM_GPIO_EVT_RINGS 0
+#endif
@@ -22,6 +22,18 @@ enum method {
     NODE_ENABLE,
     NODE_DISABLE,
     PINCTRL_HANDLE,
+    CLK_BATCH,
+    NODE_SET_ASYNC,
+    NODE_COMPLETE,
+    CLK_ROUND_RATE,
+    STATUS_PAGE,
+    GPIO_EVT_SUBSCRIBE,
+    GPIO_EVT_UNSUBSCRIBE,
+    GPIO_BANK,
+    AUTOSUSPEND,
+    STATS_GET,
+    STATS_RESET,
+    METHOD_END,
 };
 
 struct header {
@@ -40,175 +52,572 @@ struct ret {
     constexpr inline size_t size() const { return size_t(1); }
 };
 
-struct clk_enable_args : header {
-    uint64 clk_id;
+/* UTCB words a message of that many bytes takes */
+__ALWAYS_INLINE__
+constexpr inline size_t
+words(size_t bytes) {
+    return (bytes + sizeof(mword) - 1) / sizeof(mword);
+}
+
+static constexpr size_t UTCB_WORDS = PAGE_SIZE / sizeof(mword);
 
-    clk_enable_args(uint64 _id) : header(CLK_ENABLE), clk_id(_id) {}
+/**
+ * Name of the portal served on cpu. The service UUID names the portal of the
+ * boot CPU as before; a client that wants to be served on its own core looks
+ * this one up and falls back to the service UUID if there is none.
+ */
+__ALWAYS_INLINE__
+constexpr inline Uuid
+cpu_uuid(const Uuid &srv, Cpu cpu) {
+    return Uuid{srv.lo, srv.hi ^ ((uint64(cpu) + 1) << 56)};
+}
+
+/**
+ * Base of the arguments T of method M, which tags the message and gives its
+ * size in words. Messages with a trailing array hide size() and bounded()
+ * with versions that take the array into account.
+ */
+template<typename T, method M>
+struct msg : header {
+    static constexpr method ID = M;
+
+    constexpr msg(void) : header(M) {}
 
     __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_enable_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+    constexpr static inline size_t size() { return words(sizeof(T)); }
+
+    /* the counts in the message stay within what the UTCB holds */
+    __ALWAYS_INLINE__
+    constexpr inline bool bounded() const { return true; }
 };
 
-struct clk_enable_ret : ret {};
+template<typename T>
+struct reply : ret {
+    __ALWAYS_INLINE__
+    constexpr static inline size_t size() { return words(sizeof(T)); }
+};
 
-struct clk_disable_args : header {
+struct clk_enable_args : msg<clk_enable_args, CLK_ENABLE> {
     uint64 clk_id;
 
-    clk_disable_args(uint64 _id) : header(CLK_DISABLE), clk_id(_id) {}
-
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_disable_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+    clk_enable_args(uint64 _id) : clk_id(_id) {}
 };
 
-struct clk_disable_ret : ret {};
+struct clk_enable_ret : reply<clk_enable_ret> {};
 
-struct clk_is_enabled_args : header {
+struct clk_disable_args : msg<clk_disable_args, CLK_DISABLE> {
     uint64 clk_id;
 
-    clk_is_enabled_args(uint64 _id) : header(CLK_IS_ENABLED), clk_id(_id) {}
+    clk_disable_args(uint64 _id) : clk_id(_id) {}
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_is_enabled_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct clk_disable_ret : reply<clk_disable_ret> {};
+
+struct clk_is_enabled_args : msg<clk_is_enabled_args, CLK_IS_ENABLED> {
+    uint64 clk_id;
+
+    clk_is_enabled_args(uint64 _id) : clk_id(_id) {}
 };
 
-struct clk_is_enabled_ret : ret {
+struct clk_is_enabled_ret : reply<clk_is_enabled_ret> {
     uint8 enabled;
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_is_enabled_ret) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct clk_get_max_args : msg<clk_get_max_args, CLK_GET_MAX> {};
+
+struct clk_get_max_ret : reply<clk_get_max_ret> {
+    uint32 max_id;
 };
 
-struct clk_get_max_args : header {
-    clk_get_max_args(void) : header(CLK_GET_MAX) {}
+struct clk_get_rate_args : msg<clk_get_rate_args, CLK_GET_RATE> {
+    uint64 clk_id;
+
+    clk_get_rate_args(uint64 _id) : clk_id(_id) {}
 };
 
-struct clk_get_max_ret : ret {
-    uint32 max_id;
+struct clk_get_rate_ret : reply<clk_get_rate_ret> {
+    uint64 rate;
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_get_max_ret) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct clk_set_rate_args : msg<clk_set_rate_args, CLK_SET_RATE> {
+    uint64 clk_id;
+    uint64 rate;
+
+    clk_set_rate_args(uint64 _id, uint64 _rate) : clk_id(_id), rate(_rate) {}
 };
 
-struct clk_get_rate_args : header {
+struct clk_set_rate_ret : reply<clk_set_rate_ret> {};
+
+struct clk_describe_rate_args : msg<clk_describe_rate_args, CLK_DESCRIBE_RATE> {
     uint64 clk_id;
 
-    clk_get_rate_args(uint64 _id) : header(CLK_GET_RATE), clk_id(_id) {}
+    clk_describe_rate_args(uint64 _id) : clk_id(_id) {}
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_get_rate_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct clk_describe_rate_ret : reply<clk_describe_rate_ret> {
+    Pm::clk_desc desc;
 };
 
-struct clk_get_rate_ret : ret {
+/* nearest rate CLK_SET_RATE would reach without retuning a PLL */
+struct clk_round_rate_args : msg<clk_round_rate_args, CLK_ROUND_RATE> {
+    uint64 clk_id;
     uint64 rate;
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_get_rate_ret) + sizeof(mword) - 1) / sizeof(mword);
-    }
+    clk_round_rate_args(uint64 _id, uint64 _rate) : clk_id(_id), rate(_rate) {}
 };
 
-struct clk_set_rate_args : header {
-    uint64 clk_id;
+struct clk_round_rate_ret : reply<clk_round_rate_ret> {
     uint64 rate;
+};
 
-    clk_set_rate_args(uint64 _id, uint64 _rate) : header(CLK_GET_RATE), clk_id(_id), rate(_rate) {}
+/**
+ * Read-only page the driver keeps current on every change it makes, so that
+ * monitoring clients can poll state without a portal call. Copy what you
+ * need between two reads of seq and retry if seq was odd or has changed.
+ * Changes made behind the driver's back (firmware, input pins) only show
+ * up once the driver touches that state again.
+ */
+struct status_page {
+    static constexpr uint32 MAGIC = 0x52345053; /* "SP4R" */
+    static constexpr uint32 MAX_CLKS = 64;
+    static constexpr uint32 MAX_NODES = 64;
+    static constexpr uint32 GPIO_BANKS = 2;
+    static constexpr uint32 GPIO_FSEL_REGS = 6;
+
+    uint32 magic;
+    uint32 seq;
+    uint32 num_clks;
+    uint32 num_nodes;
+    uint32 num_gpios;
+    /* levels the driver drove the outputs to, one bit per pin */
+    uint32 gpio_level[GPIO_BANKS];
+    /* GPFSELn, 3 bits per pin */
+    uint32 gpio_fsel[GPIO_FSEL_REGS];
+    /* power domains as reported by the firmware, then device nodes; bit 0 is on */
+    uint8 node_state[MAX_NODES];
+    struct clk {
+        uint64 rate;
+        uint8 parent;
+        uint8 enabled;
+    } clks[MAX_CLKS];
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_set_rate_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+static_assert(sizeof(status_page) <= PAGE_SIZE, "status page must fit in one page");
+
+struct status_page_args : msg<status_page_args, STATUS_PAGE> {};
+
+/*
+ * physical address of the status page, for the client to map read-only.
+ * ENOTSUP unless the driver is built with PM_STATUS_PAGE, the page is not
+ * delegated to the client yet.
+ */
+struct status_page_ret : reply<status_page_ret> {
+    uint64 pa;
+    uint32 len;
 };
 
-struct clk_set_rate_ret : ret {};
+/* one GPIO interrupt as queued to a subscriber */
+struct gpio_evt {
+    uint64 ts;   /* Pm::ticks() when the interrupt was taken */
+    uint32 pin;
+    uint32 trig; /* the Pm::iotrig that fired */
+};
 
-struct clk_describe_rate_args : header {
-    uint64 clk_id;
+/**
+ * Single-producer ring the driver fills from the GPIO interrupt, one page per
+ * subscriber. The client consumes evts[tail % SIZE] up to head and then
+ * advances tail; events that find the ring full are only counted in dropped.
+ * A level triggered pin raises one event and is masked until the client has
+ * consumed the ring up to head, which the driver notices on the next pin
+ * control call or interrupt, or acks the pin with PM_CLR_GPIOEVT. A level still asserted by
+ * then raises the next event.
+ */
+struct gpio_evt_ring {
+    static constexpr uint32 SIZE = 128;
+
+    uint32 head;    /* written by the driver */
+    uint32 tail;    /* written by the client */
+    uint32 dropped; /* written by the driver */
+    uint32 reserved;
+    gpio_evt evts[SIZE];
+};
 
-    clk_describe_rate_args(uint64 _id) : header(CLK_DESCRIBE_RATE), clk_id(_id) {}
+static_assert(sizeof(gpio_evt_ring) <= PAGE_SIZE, "event ring must fit in one page");
+static_assert((gpio_evt_ring::SIZE & (gpio_evt_ring::SIZE - 1)) == 0, "ring size not 2^n");
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_describe_rate_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+static constexpr uint32 GPIO_EVT_CLIENTS = 4;
+
+/**
+ * pins is a mask of GPIO 0-63, triggers are still set up with PM_SET_GPIOTRIG.
+ * A pin has at most one subscriber, EBUSY if another one has it already. Only
+ * the portal that subscribed can unsubscribe, EPERM on the others. ENOTSUP
+ * unless the driver is built with PM_GPIO_EVT_RINGS: ring_pa and sm are the
+ * driver's own, nothing is delegated to the client yet.
+ */
+struct gpio_evt_subscribe_args : msg<gpio_evt_subscribe_args, GPIO_EVT_SUBSCRIBE> {
+    uint64 pins;
+
+    gpio_evt_subscribe_args(uint64 _pins) : pins(_pins) {}
 };
 
-struct clk_describe_rate_ret : ret {
-    Pm::clk_desc desc;
+/* the ring and the semaphore the driver signals after queueing events, see above */
+struct gpio_evt_subscribe_ret : reply<gpio_evt_subscribe_ret> {
+    uint32 client;
+    uint64 ring_pa;
+    uint64 sm;
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(clk_describe_rate_ret) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct gpio_evt_unsubscribe_args : msg<gpio_evt_unsubscribe_args, GPIO_EVT_UNSUBSCRIBE> {
+    uint32 client;
+
+    gpio_evt_unsubscribe_args(uint32 _client) : client(_client) {}
 };
 
-struct node_get_max_args : header {
-    node_get_max_args(void) : header(NODE_GET_MAX) {}
+struct gpio_evt_unsubscribe_ret : reply<gpio_evt_unsubscribe_ret> {};
+
+/**
+ * Node ids below DEVICE_NODE_BASE are firmware power domains. Device nodes
+ * follow, enabling one powers its domains, sets up its clocks and muxes its
+ * pins in a single call; disabling it undoes that in reverse order. A node only
+ * retunes a clock nobody else holds and fails with EBUSY when a held clock runs
+ * at another rate; the previous rate is restored when the node goes off.
+ * Disabling a device node that is not enabled fails with EINVAL.
+ */
+static constexpr uint32 DEVICE_NODE_BASE = 32;
+
+enum device_node : uint32 {
+    NODE_V3D = DEVICE_NODE_BASE,
+    NODE_H264,
+    NODE_ISP,
+    NODE_EMMC,
+    NODE_EMMC2,
+    NODE_DEVICE_END,
 };
 
-struct node_get_max_ret : ret {
-    uint32 max_id;
+struct node_get_max_args : msg<node_get_max_args, NODE_GET_MAX> {};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(node_get_max_ret) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct node_get_max_ret : reply<node_get_max_ret> {
+    uint32 max_id;
 };
 
-struct node_disable_args : header {
+struct node_disable_args : msg<node_disable_args, NODE_DISABLE> {
     uint64 node_id;
 
-    node_disable_args(uint64 _id) : header(NODE_DISABLE), node_id(_id) {}
+    node_disable_args(uint64 _id) : node_id(_id) {}
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(node_disable_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+struct node_disable_ret : reply<node_disable_ret> {};
+
+struct node_enable_args : msg<node_enable_args, NODE_ENABLE> {
+    uint64 node_id;
+
+    node_enable_args(uint64 _id) : node_id(_id) {}
 };
 
-struct node_disable_ret : ret {};
+struct node_enable_ret : reply<node_enable_ret> {};
 
-struct node_enable_args : header {
+/**
+ * Start a power domain transition and return without waiting for the
+ * firmware. The token is passed to NODE_COMPLETE, which fails with EBUSY
+ * until the transition is done and then reports its outcome, once. Tokens
+ * are only valid on the portal that returned them. Fewer transitions than
+ * there are firmware slots can be in flight, NODE_SET_ASYNC fails with EBUSY
+ * beyond that. An outcome not collected within NODE_TOKEN_TTL_NS is applied
+ * by the driver and its token becomes invalid.
+ */
+struct node_set_async_args : msg<node_set_async_args, NODE_SET_ASYNC> {
     uint64 node_id;
+    uint32 state;
 
-    node_enable_args(uint64 _id) : header(NODE_DISABLE), node_id(_id) {}
+    node_set_async_args(uint64 _id, uint32 _state) : node_id(_id), state(_state) {}
+};
 
-    __ALWAYS_INLINE__
-    constexpr static inline size_t size() {
-        return (sizeof(node_enable_args) + sizeof(mword) - 1) / sizeof(mword);
-    }
+/* token of a request that needed no firmware call, NODE_COMPLETE reports ENONE */
+static constexpr uint32 NODE_TOKEN_DONE = (1u << 31);
+
+static constexpr uint64 NODE_TOKEN_TTL_NS = 100000000ull;
+
+struct node_set_async_ret : reply<node_set_async_ret> {
+    uint32 token;
 };
 
-struct node_enable_ret : ret {};
+struct node_complete_args : msg<node_complete_args, NODE_COMPLETE> {
+    uint32 token;
 
-struct pinctrl_args_ipc : header {
+    node_complete_args(uint32 _token) : token(_token) {}
+};
+
+struct node_complete_ret : reply<node_complete_ret> {};
+
+/* PINCTRL_HANDLE flags */
+enum pinctrl_flags : uint32 {
+    PINCTRL_BEST_EFFORT = 0,
+    /* stop at the first pin that fails, the rest are left untouched */
+    PINCTRL_STOP_ON_ERROR = (1u << 0),
+};
+
+/**
+ * func is applied to every pin in order. The reply keeps the pin array in
+ * place (GET operations fill in val) and appends one status word per pin
+ * right after it; only the first num_done pins were processed. errno is the
+ * first failure, if any.
+ */
+struct pinctrl_args_ipc : msg<pinctrl_args_ipc, PINCTRL_HANDLE> {
     uint32 func;
     uint32 num_pins;
-    Pm::Pin pins[];
+    uint32 flags;
+    alignas(2 * sizeof(mword)) Pm::Pin pins[];
 
-    pinctrl_args_ipc(uint8 _func, Pm::Pin *_pins, uint32 _num_pins) : header(PINCTRL_HANDLE) {
+    pinctrl_args_ipc(uint8 _func, Pm::Pin *_pins, uint32 _num_pins,
+                     uint32 _flags = PINCTRL_BEST_EFFORT) {
         num_pins = _num_pins;
         func = _func;
-        for (uint8 i = 0; i < num_pins; i++)
+        flags = _flags;
+        for (uint32 i = 0; i < num_pins; i++)
             pins[i] = _pins[i];
     }
-    /*Size must be explicit!*/
+
+    __ALWAYS_INLINE__
+    inline size_t size() const {
+        return words(sizeof(pinctrl_args_ipc) + num_pins * sizeof(Pm::Pin));
+    }
+
+    inline bool bounded() const;
+};
+
+struct pinctrl_ret_ipc : reply<pinctrl_ret_ipc> {
+    uint32 num_done;
+    alignas(2 * sizeof(mword)) Pm::Pin pins[];
+
+    __ALWAYS_INLINE__
+    inline uint32 *status(uint32 num_pins) { return reinterpret_cast<uint32 *>(&pins[num_pins]); }
+
+    __ALWAYS_INLINE__
+    static inline size_t size(uint32 num_pins) {
+        return words(sizeof(pinctrl_ret_ipc) + num_pins * (sizeof(Pm::Pin) + sizeof(uint32)));
+    }
+};
+
+static_assert(sizeof(pinctrl_args_ipc) == sizeof(pinctrl_ret_ipc),
+              "PINCTRL_HANDLE arguments and reply must share the pin array");
+
+/* pins and their status words have to fit in the UTCB page */
+static constexpr uint32 PINCTRL_MAX_PINS
+    = (PAGE_SIZE - sizeof(pinctrl_args_ipc)) / (sizeof(Pm::Pin) + sizeof(uint32));
+
+inline bool
+pinctrl_args_ipc::bounded() const {
+    return num_pins <= PINCTRL_MAX_PINS;
+}
+
+/**
+ * GPIO_BANK runs one of the whole-bank Pm_custom_ops on all pins at once,
+ * bit n of every mask is GPIO n:
+ *  PM_GET_GPIOBANK      mask = pad levels
+ *  PM_SET_GPIOBANK      drive the set pins high and the clr pins low
+ *  PM_GET_GPIOEVTBANK   mask = pending events
+ *  PM_CLR_GPIOEVTBANK   clear the events in set
+ *  PM_GET_GPIOTRIGBANK  mask = pins with the Pm::iotrig bit trig enabled
+ * Each costs one register access per bank at most.
+ */
+struct gpio_bank_args : msg<gpio_bank_args, GPIO_BANK> {
+    uint32 func;
+    uint32 trig;
+    uint64 set;
+    uint64 clr;
+
+    gpio_bank_args(uint8 _func, uint64 _set = 0, uint64 _clr = 0, uint32 _trig = 0)
+        : func(_func), trig(_trig), set(_set), clr(_clr) {}
+};
+
+struct gpio_bank_ret : reply<gpio_bank_ret> {
+    uint64 mask;
+};
+
+enum autosuspend_target : uint32 {
+    AUTOSUSPEND_CLK = 0,
+    AUTOSUSPEND_NODE,
+};
+
+/**
+ * Autosuspend delay of a clock or a node, for a device node that of each of
+ * its domains and clocks. With a delay, the last disable leaves the clock or
+ * domain running and gates it only once it stayed unused that long; an
+ * enable before that is a reference count update. 0, the default, gates
+ * right away, delays above AUTOSUSPEND_MAX_US are refused. Timers are
+ * checked whenever a client releases a clock or node or sets a delay, until
+ * then an idle clock keeps running.
+ */
+static constexpr uint64 AUTOSUSPEND_MAX_US = 3600ull * 1000000ull;
+
+struct autosuspend_args : msg<autosuspend_args, AUTOSUSPEND> {
+    uint32 target;
+    uint32 id;
+    uint64 delay_us;
+
+    autosuspend_args(uint32 _target, uint32 _id, uint64 _delay_us)
+        : target(_target), id(_id), delay_us(_delay_us) {}
+};
+
+struct autosuspend_ret : reply<autosuspend_ret> {};
+
+/**
+ * Statistics ids. The portal handler has one per method, indexed by the
+ * method; the clock operations and the mailbox follow. Durations are in
+ * ticks of the counter whose frequency STATS_GET reports.
+ */
+enum stat_id : uint32 {
+    STAT_CLK_PREPARE = METHOD_END,
+    STAT_CLK_UNPREPARE,
+    STAT_CLK_SET_RATE,
+    STAT_CLK_SET_PARENT,
+    STAT_PLL_LOCK,
+    STAT_FW_MSG,  /* mailbox message, from post to the answer */
+    STAT_FW_CALL, /* synchronous firmware call */
+    STAT_COUNT,
+};
+
+/* copies of the statistics first..first+num-1, num as many as fit in the UTCB */
+struct stats_get_args : msg<stats_get_args, STATS_GET> {
+    uint32 first;
+
+    stats_get_args(uint32 _first = 0) : first(_first) {}
+};
+
+struct stats_get_ret : reply<stats_get_ret> {
+    uint32 num_stats; /* STAT_COUNT */
+    uint32 num;
+    uint64 tick_freq;
+    uint64 portal_cpus; /* CPUs with a portal of their own, see cpu_uuid() */
+    Pm::Stat stats[];
+
+    __ALWAYS_INLINE__
+    inline size_t size() const {
+        return words(sizeof(stats_get_ret) + num * sizeof(Pm::Stat));
+    }
 };
 
-struct pinctrl_ret_ipc : ret {
-    Pm::Pin pins[];
-    /*Size must be explicit!*/
+static constexpr uint32 STATS_MAX = (PAGE_SIZE - sizeof(stats_get_ret)) / sizeof(Pm::Stat);
+
+struct stats_reset_args : msg<stats_reset_args, STATS_RESET> {};
+
+struct stats_reset_ret : reply<stats_reset_ret> {};
+
+/* operations allowed in a CLK_BATCH entry */
+enum clk_batch_op : uint32 {
+    CLK_OP_ENABLE = 0,
+    CLK_OP_DISABLE,
+    CLK_OP_IS_ENABLED,
+    CLK_OP_GET_RATE,
+    CLK_OP_SET_RATE,
+};
+
+/**
+ * One clock operation of a CLK_BATCH call, updated in place with the result.
+ * On return rate holds the clock rate after the operation (1/0 for
+ * CLK_OP_IS_ENABLED) and err the outcome of this entry.
+ */
+struct clk_batch_entry {
+    uint32 clk_id;
+    uint32 op;
+    uint64 rate;
+    uint32 err;
+    uint32 reserved;
 };
 
+/**
+ * Entries are executed in order and processing stops at the first failure,
+ * so that e.g. a clock is never enabled after its PLL failed to come up.
+ * The reply reports how many entries succeeded; on failure the entry right
+ * after them carries the error. Arguments and reply share the entry array,
+ * nothing is copied.
+ */
+struct clk_batch_args_ipc : msg<clk_batch_args_ipc, CLK_BATCH> {
+    uint32 num_clks;
+    alignas(2 * sizeof(mword)) clk_batch_entry clks[];
+
+    clk_batch_args_ipc(clk_batch_entry *_clks, uint32 _num_clks) {
+        num_clks = _num_clks;
+        for (uint32 i = 0; i < num_clks; i++)
+            clks[i] = _clks[i];
+    }
+
+    __ALWAYS_INLINE__
+    inline size_t size() const {
+        return words(sizeof(clk_batch_args_ipc) + num_clks * sizeof(clk_batch_entry));
+    }
+
+    inline bool bounded() const;
+};
+
+struct clk_batch_ret_ipc : reply<clk_batch_ret_ipc> {
+    uint32 num_done;
+    alignas(2 * sizeof(mword)) clk_batch_entry clks[];
+
+    /* the succeeded entries, plus the failing one if the batch stopped early */
+    __ALWAYS_INLINE__
+    inline size_t size(uint32 num_clks) const {
+        uint32 num = num_done + (errno != Errno::ENONE && num_done < num_clks);
+        return words(sizeof(clk_batch_ret_ipc) + num * sizeof(clk_batch_entry));
+    }
+};
+
+static_assert(sizeof(clk_batch_args_ipc) == sizeof(clk_batch_ret_ipc),
+              "CLK_BATCH arguments and reply must share the entry array");
+
+/* the whole batch has to fit in the UTCB page */
+static constexpr uint32 CLK_BATCH_MAX
+    = (PAGE_SIZE - sizeof(clk_batch_args_ipc)) / sizeof(clk_batch_entry);
+
+inline bool
+clk_batch_args_ipc::bounded() const {
+    return num_clks <= CLK_BATCH_MAX;
+}
+
+/**
+ * Arguments and reply of every method the driver serves, its portal builds
+ * the dispatch table from these. A message that claims more words than the
+ * client sent or than the UTCB holds is refused with EINVAL.
+ */
+template<method M>
+struct def {
+    static constexpr bool defined = false;
+};
+
+#define DRV_IPC_DEF(_method_, _in_, _out_)                                                         \
+    template<>                                                                                     \
+    struct def<_method_> {                                                                         \
+        static constexpr bool defined = true;                                                      \
+        using in = _in_;                                                                           \
+        using out = _out_;                                                                         \
+        static_assert(_in_::ID == _method_, #_in_ " is not tagged " #_method_);                    \
+        static_assert(sizeof(_in_) <= PAGE_SIZE && sizeof(_out_) <= PAGE_SIZE,                     \
+                      #_method_ " does not fit in the UTCB");                                      \
+    }
+
+DRV_IPC_DEF(CLK_IS_ENABLED, clk_is_enabled_args, clk_is_enabled_ret);
+DRV_IPC_DEF(CLK_GET_MAX, clk_get_max_args, clk_get_max_ret);
+DRV_IPC_DEF(CLK_ENABLE, clk_enable_args, clk_enable_ret);
+DRV_IPC_DEF(CLK_DISABLE, clk_disable_args, clk_disable_ret);
+DRV_IPC_DEF(CLK_GET_RATE, clk_get_rate_args, clk_get_rate_ret);
+DRV_IPC_DEF(CLK_SET_RATE, clk_set_rate_args, clk_set_rate_ret);
+DRV_IPC_DEF(CLK_DESCRIBE_RATE, clk_describe_rate_args, clk_describe_rate_ret);
+DRV_IPC_DEF(NODE_GET_MAX, node_get_max_args, node_get_max_ret);
+DRV_IPC_DEF(NODE_ENABLE, node_enable_args, node_enable_ret);
+DRV_IPC_DEF(NODE_DISABLE, node_disable_args, node_disable_ret);
+DRV_IPC_DEF(PINCTRL_HANDLE, pinctrl_args_ipc, pinctrl_ret_ipc);
+DRV_IPC_DEF(CLK_BATCH, clk_batch_args_ipc, clk_batch_ret_ipc);
+DRV_IPC_DEF(NODE_SET_ASYNC, node_set_async_args, node_set_async_ret);
+DRV_IPC_DEF(NODE_COMPLETE, node_complete_args, node_complete_ret);
+DRV_IPC_DEF(CLK_ROUND_RATE, clk_round_rate_args, clk_round_rate_ret);
+DRV_IPC_DEF(STATUS_PAGE, status_page_args, status_page_ret);
+DRV_IPC_DEF(GPIO_EVT_SUBSCRIBE, gpio_evt_subscribe_args, gpio_evt_subscribe_ret);
+DRV_IPC_DEF(GPIO_EVT_UNSUBSCRIBE, gpio_evt_unsubscribe_args, gpio_evt_unsubscribe_ret);
+DRV_IPC_DEF(GPIO_BANK, gpio_bank_args, gpio_bank_ret);
+DRV_IPC_DEF(AUTOSUSPEND, autosuspend_args, autosuspend_ret);
+DRV_IPC_DEF(STATS_GET, stats_get_args, stats_get_ret);
+DRV_IPC_DEF(STATS_RESET, stats_reset_args, stats_reset_ret);
+
+#undef DRV_IPC_DEF
+
 }
@@ -24,6 +24,208 @@ early_error(mword err) {
 
 namespace Pm {
 
+/**
+ * Monotonic time source for bounded hardware waits. On the target this is the
+ * ARM generic timer, the host build supplies a simulated clock instead.
+ */
+#ifdef PM_HOST_SIM
+uint64 ticks(void);
+uint64 tick_freq(void);
+void relax(void);
+#else
+static inline uint64
+ticks(void) {
+    uint64 cnt;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt)::"memory");
+    return cnt;
+}
+
+static inline uint64
+tick_freq(void) {
+    uint64 freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
+static inline void
+relax(void) {
+    asm volatile("yield" ::: "memory");
+}
+#endif
+
+static inline uint64
+ns_to_ticks(uint64 ns) {
+    /* split to stay clear of overflow for timeouts of many seconds */
+    uint64 freq = tick_freq();
+    return (ns / 1000000000ull) * freq + ((ns % 1000000000ull) * freq) / 1000000000ull;
+}
+
+/* test-and-test-and-set lock for state shared between portal ECs */
+class Spinlock {
+public:
+    void lock(void) {
+        while (__atomic_exchange_n(&_locked, true, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&_locked, __ATOMIC_RELAXED))
+                relax();
+        }
+    }
+
+    void unlock(void) { __atomic_store_n(&_locked, false, __ATOMIC_RELEASE); }
+
+private:
+    bool _locked{false};
+};
+
+class Lock_guard {
+public:
+    explicit Lock_guard(Spinlock &lock) : _lock(lock) { _lock.lock(); }
+    ~Lock_guard() { _lock.unlock(); }
+
+    Lock_guard(const Lock_guard &) = delete;
+    Lock_guard &operator=(const Lock_guard &) = delete;
+
+private:
+    Spinlock &_lock;
+};
+
+/**
+ * Versioned copy of a value for lock-free readers. Writers must already be
+ * serialized, e.g. by the lock of the state the value mirrors; readers retry
+ * until they saw a copy no writer touched in between.
+ */
+template<typename T>
+class Seqlock {
+public:
+    void write(const T &val) {
+        uint32 seq = __atomic_load_n(&_seq, __ATOMIC_RELAXED);
+        __atomic_store_n(&_seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        _val = val;
+        __atomic_store_n(&_seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    T read(void) const {
+        while (true) {
+            uint32 seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+            if (!(seq & 1)) {
+                T val = _val;
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq) return val;
+            }
+            relax();
+        }
+    }
+
+private:
+    uint32 _seq{0};
+    T _val{};
+};
+
+/**
+ * Earliest deadline of a set of idle timers. There is no timer interrupt for
+ * the driver, the deadline is polled by the calls that release something;
+ * polling with nothing armed is a load. Whoever takes the expired deadline scans the
+ * timers and re-arms the ones that are not due yet.
+ */
+class Idle_timer {
+public:
+    static constexpr uint64 NEVER = ~0ull;
+
+    /* deadline delay ticks from now, never 0 which stands for disarmed */
+    static uint64 deadline(uint64 delay) {
+        uint64 at = ticks() + delay;
+        return at ? at : 1;
+    }
+
+    void arm(uint64 at) {
+        uint64 cur = __atomic_load_n(&_next, __ATOMIC_SEQ_CST);
+        while (at < cur
+               && !__atomic_compare_exchange_n(&_next, &cur, at, true, __ATOMIC_SEQ_CST,
+                                               __ATOMIC_SEQ_CST)) {}
+    }
+
+    bool armed(void) const { return __atomic_load_n(&_next, __ATOMIC_RELAXED) != NEVER; }
+
+    /* true if the deadline passed, which disarms it until the scan re-arms */
+    bool take(uint64 now) {
+        uint64 cur = __atomic_load_n(&_next, __ATOMIC_SEQ_CST);
+        while (cur <= now) {
+            if (__atomic_compare_exchange_n(&_next, &cur, NEVER, true, __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    uint64 _next{NEVER};
+};
+
+/**
+ * Number of events and a log2 histogram of their durations in ticks: hist[n]
+ * counts durations of n significant bits, the last bucket everything longer.
+ * Updated with relaxed atomics from any EC and without a lock; a reader gets
+ * every field intact, not all fields from the same instant.
+ */
+struct Stat {
+    static constexpr uint32 BUCKETS = 24;
+
+    uint64 count;
+    uint64 total;
+    uint64 max;
+    uint32 hist[BUCKETS];
+
+    void record(uint64 t) {
+        uint32 b = t ? static_cast<uint32>(64 - __builtin_clzll(t)) : 0;
+        if (b >= BUCKETS) b = BUCKETS - 1;
+
+        __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&total, t, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&hist[b], 1, __ATOMIC_RELAXED);
+
+        uint64 cur = __atomic_load_n(&max, __ATOMIC_RELAXED);
+        while (t > cur
+               && !__atomic_compare_exchange_n(&max, &cur, t, true, __ATOMIC_RELAXED,
+                                               __ATOMIC_RELAXED)) {}
+    }
+
+    /* record() for a Stat only one EC ever records to, no read-modify-write */
+    void record_local(uint64 t) {
+        uint32 b = t ? static_cast<uint32>(64 - __builtin_clzll(t)) : 0;
+        if (b >= BUCKETS) b = BUCKETS - 1;
+
+        __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&total, total + t, __ATOMIC_RELAXED);
+        __atomic_store_n(&hist[b], hist[b] + 1, __ATOMIC_RELAXED);
+        if (t > max) __atomic_store_n(&max, t, __ATOMIC_RELAXED);
+    }
+
+    /* add a copy taken with read() */
+    void merge(const Stat &s) {
+        count += s.count;
+        total += s.total;
+        if (s.max > max) max = s.max;
+        for (uint32 b = 0; b < BUCKETS; b++)
+            hist[b] += s.hist[b];
+    }
+
+    void read(Stat &out) const {
+        out.count = __atomic_load_n(&count, __ATOMIC_RELAXED);
+        out.total = __atomic_load_n(&total, __ATOMIC_RELAXED);
+        out.max = __atomic_load_n(&max, __ATOMIC_RELAXED);
+        for (uint32 b = 0; b < BUCKETS; b++)
+            out.hist[b] = __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+    }
+
+    void reset(void) {
+        __atomic_store_n(&count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&max, 0, __ATOMIC_RELAXED);
+        for (uint32 b = 0; b < BUCKETS; b++)
+            __atomic_store_n(&hist[b], 0, __ATOMIC_RELAXED);
+    }
+};
+
 /* used for bulk requests to the pin controller */
 typedef struct Pin_t {
     uint32 id;
@@ -75,6 +277,12 @@ enum Pm_custom_ops {
     PM_SET_GPIOTRIG = 0x1cu,
     PM_GET_GPIOEVT = 0x1eu,
     PM_CLR_GPIOEVT = 0x1fu,
+    /* whole-bank variants, see drv_ipc::gpio_bank_args */
+    PM_GET_GPIOBANK = 0x20u,
+    PM_SET_GPIOBANK = 0x21u,
+    PM_GET_GPIOEVTBANK = 0x22u,
+    PM_CLR_GPIOEVTBANK = 0x23u,
+    PM_GET_GPIOTRIGBANK = 0x24u,
 };
 
 struct Ennode_args_ipc {
@@ -21,7 +21,17 @@ static constexpr uint32 GPIO_BASE = (MBOX_BASE + MBOX_SIZE);
 static constexpr uint32 GPIO_SIZE = 0x1000;
 static constexpr uint32 FW_BASE = (GPIO_BASE + GPIO_SIZE);
 static constexpr uint32 FW_SIZE = 0x1000;
-static constexpr uint32 DEV_MMIO_END = (FW_BASE + FW_SIZE);
+static constexpr uint32 STATUS_BASE = (FW_BASE + FW_SIZE);
+static constexpr uint32 STATUS_SIZE = 0x1000;
+static constexpr uint32 EVT_BASE = (STATUS_BASE + STATUS_SIZE);
+static constexpr uint32 EVT_SIZE = (drv_ipc::GPIO_EVT_CLIENTS * 0x1000);
+static constexpr uint32 DEV_MMIO_END = (EVT_BASE + EVT_SIZE);
+
+static constexpr uint32 NUM_DEVICE_NODES = (drv_ipc::NODE_DEVICE_END - drv_ipc::DEVICE_NODE_BASE);
+static constexpr uint32 DEVICE_MAX_CLKS = 2;
+
+/* the bcm2711 GPIO block raises one interrupt per bank and one for all banks */
+static constexpr mword GPIO_IRQ_ALL_BANKS = 3;
 
 class Rpi4 {
 public:
@@ -40,6 +50,8 @@ public:
 
     Errno describe_clkrate(uint64 clk_id, Pm::clk_desc &rate);
 
+    Errno round_clkrate(uint64 clk_id, uint64 rate, uint64 &rounded);
+
     bool is_clk_enabled(uint64 clk_id);
 
     bool is_clk_valid(uint64 clk_id);
@@ -50,14 +62,171 @@ public:
 
     Errno disable_node(uint64 node_id);
 
-    Errno handle_pinctrl(Pm::Pin *pins, uint32 num_pins, uint32 func);
+    /**
+     * split-phase enable/disable_node, the portal is free while the VPU works.
+     * client is the portal the request came through, only it can complete it.
+     */
+    Errno post_node_state(Cpu client, uint64 node_id, bool on, uint32 &token);
+
+    Errno complete_node_state(Cpu client, uint32 token);
+
+    Errno handle_pinctrl(Pm::Pin *pins, uint32 num_pins, uint32 func, uint32 flags,
+                         uint32 *status, uint32 &num_done);
+
+    /* whole-bank Pm_custom_ops, see drv_ipc::gpio_bank_args */
+    Errno handle_gpio_bank(uint32 func, uint32 trig, uint64 set, uint64 clr, uint64 &mask);
+
+    Errno handle_clk_batch(drv_ipc::clk_batch_entry *clks, uint32 num_clks, uint32 &num_done);
+
+    /* where clients map the status page from */
+    Errno get_status_page(uint64 &pa, uint32 &len);
+
+    /* GPIO event rings and their semaphores, sm_base..+GPIO_EVT_CLIENTS-1 */
+    Errno gpio_evt_init(Pbl::Utcb *utcb, Sel sm_base);
+
+    /* a pin has one subscriber, only the portal cpu subscribed through can unsubscribe */
+    Errno gpio_evt_subscribe(Cpu cpu, uint64 pins, uint32 &client, uint64 &ring_pa, Sel &sm);
+
+    Errno gpio_evt_unsubscribe(Cpu cpu, uint32 client);
+
+    /* runs on the GPIO interrupt EC, queues pending events to the subscribers */
+    void handle_gpio_irq(void);
+
+    /* re-enable the level triggers of events the subscribers have consumed */
+    void rearm_gpio_levels(void);
+
+    /* autosuspend delays, see drv_ipc::autosuspend_args */
+    Errno set_clk_autosuspend(uint64 clk_id, uint64 delay_ns);
+
+    Errno set_node_autosuspend(uint64 node_id, uint64 delay_ns);
+
+    /* gate the clocks and domains that stayed idle past their delay */
+    void expire_idle(void);
+
+    /* latency statistics, see drv_ipc::stat_id */
+    void record_method(Cpu cpu, uint32 method, uint64 ticks);
+
+    uint32 get_stats(uint32 first, Pm::Stat *stats, uint32 max);
+
+    void reset_stats(void);
+
+    /* cpu got a portal of its own, reported by STATS_GET */
+    void add_portal(Cpu cpu) { _portal_cpus |= 1ull << cpu; }
+
+    uint64 portal_cpus(void) { return _portal_cpus; }
 
     /*use LEDs to signal successful initialization*/
     void success(void);
 
 private:
+    /* status page updates, writers are serialized by _status_lock */
+    void status_begin(void);
+
+    void status_end(void);
+
+    void publish_clocks(void);
+
+    void publish_gpios(void);
+
+    void publish_node(uint32 node_id, uint32 state);
+
     /* available devices */
     cprman _clock_manager;
     rpi_pinctrl _pinctrl;
     rpi_fw _fw;
+
+    drv_ipc::status_page *_status;
+    mword _status_pa;
+    Pm::Spinlock _status_lock;
+
+    /* per service EC, each only written by its own portal */
+    Pm::Stat _method_stats[PM_MAX_CPUS][drv_ipc::METHOD_END];
+    uint64 _portal_cpus;
+
+    /**
+     * Power domains as the firmware reported them at probe and as we set them
+     * since. Every enable_node takes a reference, only the first and the last
+     * reference reach the firmware. The lock is held across the firmware
+     * call so that transitions of one domain are ordered; a split-phase
+     * transition in flight makes other requests for the domain fail with
+     * EBUSY until it is completed. With an autosuspend delay the last
+     * reference leaves the domain on until idle_at, see expire_domains().
+     */
+    struct power_domain {
+        uint32 refs;
+        bool on;
+        bool pending;
+        uint64 idle_delay;
+        uint64 idle_at; /* 0 unless the idle timer runs */
+        Pm::Spinlock lock;
+    } _pd[RPI_POWER_DOMAIN_COUNT];
+    uint32 _idle_pds; /* domains the next scan looks at */
+    Pm::Idle_timer _pd_idle;
+
+    /* refs updated for the request, true if the firmware has to do it */
+    bool pd_request(uint32 pd, bool on);
+
+    void set_pd_autosuspend(uint32 pd, uint64 delay);
+
+    /* power off the idle domains, one firmware message for all of them */
+    void expire_domains(uint64 now);
+
+    /* every domain in the pds mask, one firmware message for those that change */
+    Errno request_domains(uint32 pds, bool on);
+
+    /* device nodes, see device_nodes[] in rpi4.cpp */
+    struct device_state {
+        uint32 refs;
+        uint64 saved_rate[DEVICE_MAX_CLKS]; /* restored on disable, 0 if the rate was kept */
+        Pm::Spinlock lock;
+    } _dev[NUM_DEVICE_NODES];
+
+    Errno enable_device(uint32 dev);
+
+    /* a clock other consumers hold keeps its rate, EBUSY if that is not rate */
+    Errno enable_device_clk(uint8 clk_id, uint64 rate, uint64 &saved_rate);
+
+    Errno disable_device_clk(uint8 clk_id, uint64 saved_rate);
+
+    Errno disable_device(uint32 dev);
+
+    Errno set_device_pins(uint32 dev, bool on);
+
+    /*
+     * split-phase node transitions, to publish their outcome on completion.
+     * Under _posted_lock, which nests inside the domain locks and outside the
+     * firmware lock.
+     */
+    struct posted_node {
+        uint32 token;
+        uint32 node_id;
+        uint32 state;
+        uint32 refs;    /* before the request, restored if it fails */
+        uint64 idle_at; /* likewise */
+        Cpu client;
+        uint64 expires; /* ticks, the driver collects the outcome after that */
+        bool used;
+    } _posted[RPI_FW_MAX_SLOTS];
+    Pm::Spinlock _posted_lock;
+    Pm::Idle_timer _posted_reap;
+
+    /* apply the outcome of a posted transition to its domain */
+    void finish_node_state(const posted_node &done, Errno err);
+
+    /* collect the outcomes whose clients did not within NODE_TOKEN_TTL_NS */
+    void reap_posted(uint64 now);
+
+    /* GPIO event subscribers, under _evt_lock */
+    struct gpio_evt_client {
+        uint64 pins;
+        uint64 masked; /* level pins queued to the ring and not consumed yet */
+        Sel sm;
+        Cpu cpu; /* portal the slot was taken through */
+        bool used;
+    } _evt_client[drv_ipc::GPIO_EVT_CLIENTS];
+    drv_ipc::gpio_evt_ring *_evt_ring;
+    mword _evt_pa;
+    uint64 _evt_pins;   /* union of the subscribed pins */
+    uint64 _evt_masked; /* union of the clients' masked pins, read without the lock */
+    Pm::Spinlock _evt_lock;
 };
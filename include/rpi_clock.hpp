@@ -292,6 +292,7 @@
 #define CM_AUX_SPI2_SHIFT 2
 
 #define LOCK_TIMEOUT_NS 100000000
+#define CPRMAN_WAIT_BACKOFF 64
 #define BCM2835_MAX_FB_RATE 1750000000u
 
 #define SOC_BCM2835 BIT(0)
@@ -387,6 +388,60 @@ struct clk_rate_request {
     uint8 best_parent;
 };
 
+/**
+ * Outcome of cprman::plan_rate(): which mux parent to run from, whether its
+ * PLL channel divider has to change and the clock divisor to program.
+ */
+struct clk_rate_plan {
+    uint8 parent;      /* clock id of the mux parent */
+    uint8 parent_idx;  /* its mux index */
+    uint32 parent_div; /* new PLL channel divider, 0 to leave the channel alone */
+    uint64 parent_rate;
+    uint32 div; /* clock divisor, CM_DIV_FRAC_BITS fixed point */
+    uint64 rate;
+};
+
+#define BCM2711_MAX_CLK_PARENTS 10
+
+/**
+ * What a muxed clock can run at from its parents as they are now. Rates
+ * from one parent are parent_rate / div over the divisor range, monotonic
+ * in the divisor, so the nearest one to a target is found directly.
+ */
+struct clk_rate_index {
+    struct {
+        uint8 parent;
+        uint8 parent_idx;
+        uint64 parent_rate;
+        uint64 min;
+        uint64 max;
+    } src[BCM2711_MAX_CLK_PARENTS];
+    uint8 num_src;
+    bool has_mux;
+    uint64 min;
+    uint64 max;
+};
+
+/**
+ * Lock domains of the clock tree. Every PLL subtree gets its own lock, the
+ * oscillator and the firmware-owned PLLB share the last one.
+ */
+enum clk_domain : uint8 {
+    CLK_DOMAIN_PLLA = 0,
+    CLK_DOMAIN_PLLC,
+    CLK_DOMAIN_PLLD,
+    CLK_DOMAIN_PLLH,
+    CLK_DOMAIN_OSC,
+    CLK_DOMAIN_COUNT,
+};
+
+/* what lock-free readers see of a clock */
+struct clk_state {
+    uint64 rate;
+    uint8 parent;
+    bool enabled;
+};
+
 class cprman {
 public:
     Errno probe(mword base, mword aux_base);
@@ -398,8 +453,28 @@ public:
         return ret;
     }
 
+    /**
+     * Poll reg until (reg & mask) == val. Gives up with ETIMEDOUT once
+     * timeout_ns has passed so a wedged PLL or divider cannot stall the portal.
+     * With backoff, the pause between polls doubles up to CPRMAN_WAIT_BACKOFF
+     * relax cycles.
+     */
+    Errno wait_for(uint32 reg, uint32 mask, uint32 val, uint64 timeout_ns, bool backoff = true);
+
     void write_aux(uint32 reg, uint32 val) { outd((_aux_base + reg), val); }
 
+    /* read-modify-write of the AUX enable register, shared by all AUX clocks */
+    void modify_aux(uint32 reg, uint32 clr, uint32 set) {
+        Pm::Lock_guard guard(_aux_lock);
+        write_aux(reg, (read_aux(reg) & ~clr) | set);
+    }
+
+    /* read-modify-write of a register every PLL subtree uses, A2W_XOSC_CTRL */
+    void modify_shared(uint32 reg, uint32 clr, uint32 set) {
+        Pm::Lock_guard guard(_shared_lock);
+        write(reg, (read(reg) & ~clr) | set);
+    }
+
     uint32 read_aux(uint32 reg) {
         uint32 ret = ind(_aux_base + reg);
         return ret;
@@ -409,15 +484,209 @@ public:
 
     uint8 get_max_clock(void) { return (BCM2711_CLOCK_TOTAL - 1); }
 
+    /**
+     * Rates are memoized per clock. Computing a leaf rate means reading the
+     * divider, mux and PLL registers all the way up to the oscillator, so the
+     * result is kept until a mutation below goes through this class. Every
+     * operation that can change a rate must use these wrappers rather than the
+     * rpi_clock methods, so that the clock and all its descendants get
+     * invalidated. Changes made behind our back by the firmware are not seen
+     * until then.
+     */
+    uint64 get_rate(uint8 id);
+
+    void invalidate_rate(uint8 id);
+
+    /**
+     * Rate, parent and enable bit as of the last change made through this
+     * class, without a lock or a register access. Every clock invalidate_rate()
+     * reaches is republished when the domain locks covering it are dropped.
+     */
+    clk_state state(uint8 id) {
+        return (id < BCM2711_CLOCK_TOTAL) ? _state[id].read() : clk_state{};
+    }
+
+    /* clocks republished since the last call, one bit per id */
+    uint64 take_published(void) { return __atomic_exchange_n(&_published, 0, __ATOMIC_ACQ_REL); }
+
+    Errno prepare(uint8 id);
+
+    Errno unprepare(uint8 id);
+
+    /* plans with plan_rate() and applies the plan when the clock has a mux */
+    Errno set_rate(uint8 id, uint64 rate);
+
+    Errno set_parent(uint8 id, uint8 idx);
+
+    /**
+     * Search every usable mux parent, the divider of PLL channel parents that
+     * nobody else is running from (up to their boot rate), and the clock
+     * divisor for the rate closest to the target. Rates above rate + tolerance
+     * are never picked. A PLLC channel is only used if the clock already runs
+     * from PLLC, since the firmware retunes PLLC behind our back. ENOTSUP for
+     * clocks without a mux, which keep their own set_rate().
+     */
+    Errno plan_rate(uint8 id, uint64 rate, uint64 tolerance, clk_rate_plan &plan);
+
+    /* the rate set_rate() would program for the target, without programming it */
+    Errno planned_rate(uint8 id, uint64 rate, uint64 &planned);
+
+    Errno apply_rate_plan(uint8 id, const clk_rate_plan &plan);
+
+    /**
+     * Built on first use and kept until a rate above the clock changes,
+     * like the rate cache. nullptr for clocks without a mux.
+     */
+    const clk_rate_index *rate_index(uint8 id);
+
+    /* real min/max for muxed clocks, the clock's own description otherwise */
+    Errno describe_rate(uint8 id, Pm::clk_desc &desc);
+
+    /* nearest rate the clock reaches from the current parent rates */
+    Errno round_rate(uint8 id, uint64 rate, uint64 &rounded);
+
+    /**
+     * Consumer reference counting. The first enable of a clock brings up its
+     * parents, PLL and PLL channel included, and the last disable gates it
+     * and releases every ancestor nobody else needs. A clock found running
+     * at probe holds a reference on its parent like any other running child.
+     * disable() of a clock that was never enable()d still gates it, as long
+     * as no running child depends on it.
+     */
+    Errno enable(uint8 id);
+
+    Errno disable(uint8 id);
+
+    /* references taken with enable(), callers hold the lock */
+    uint32 users(uint8 id) { return (id < BCM2711_CLOCK_TOTAL) ? _users[id] : 0; }
+
+    /**
+     * Autosuspend, delay in ticks and 0 (the default) to gate right away.
+     * With a delay, the last reference going away, of a consumer or of a
+     * running child, leaves the clock running and arms its idle timer. The
+     * clock is gated and its parent released only when the timer expires,
+     * an enable before that just takes the reference. Callers hold the lock.
+     */
+    void set_autosuspend(uint8 id, uint64 delay);
+
+    uint64 autosuspend(uint8 id) { return (id < BCM2711_CLOCK_TOTAL) ? _idle_delay[id] : 0; }
+
+    /* gate the clocks whose idle timer expired by now, takes the locks itself */
+    void expire_idle(uint64 now);
+
+    bool idle_armed(void) { return _idle_timer.armed(); }
+
+    /* time spent in the clock operations that touch CPRMAN, in ticks */
+    enum clk_stat : uint32 {
+        CLK_STAT_PREPARE = 0,
+        CLK_STAT_UNPREPARE,
+        CLK_STAT_SET_RATE,
+        CLK_STAT_SET_PARENT,
+        CLK_STAT_PLL_LOCK, /* prepare of a PLL, mostly waiting for the lock */
+        CLK_STAT_COUNT,
+    };
+
+    const Pm::Stat &stat(uint32 i) { return _stats[i]; }
+
+    void reset_stats(void) {
+        for (auto &s : _stats)
+            s.reset();
+    }
+
+    /**
+     * Take the lock of the subtree the clock currently sits in. Callers hold
+     * it around every operation below; the rate cache, refcounts and the
+     * registers of that subtree are only touched under it. reroute also
+     * takes the subtree of every mux parent, for operations that may move
+     * the clock or read the rates it could move to. Locks are taken in
+     * domain order and the result is handed back to unlock().
+     */
+    uint8 lock(uint8 id, bool reroute);
+
+    void unlock(uint8 held);
+
     cprman(void);
 
     ~cprman(void);
 
 private:
+    /* subtree of the PLL the clock is below, by its current parents */
+    uint8 find_domain(uint8 id);
+
+    /* recompute the cached domains of the clocks in ids after a re-parent */
+    void update_domains(uint64 ids);
+
+    uint8 domains(uint8 id, bool reroute);
+
+    /* whether the parents of the instantiated clock agree with clk_topology_of(id) */
+    bool matches_topology(uint8 id);
+
+    /* refresh the snapshots of the dirty clocks in the held domains */
+    void publish(uint8 held);
+
+    void publish_clock(uint8 id);
+
+    static constexpr uint64 RATE_BIT(uint8 id) { return (1ull << id); }
+
+    /* references held on a clock, by consumers and by running children */
+    uint32 refs(uint8 id) { return _users[id] + _children_on[id]; }
+
+    Errno power_up(uint8 id);
+
+    Errno power_down(uint8 id);
+
+    Errno get_child_ref(uint8 parent);
+
+    void put_child_ref(uint8 parent);
+
+    /* the last reference is gone, gate now or arm the idle timer */
+    Errno release(uint8 id);
+
+    static bool is_pllc(uint8 id) { return (id >= BCM2835_PLLC_CORE0) && (id <= BCM2835_PLLC_PER); }
+
+    bool can_redivide(uint8 parent, uint8 child);
+
     mword _base;
     mword _aux_base;
     static constexpr uint32 CM_PASSWORD = 0x5a000000;
     rpi_clock *_clks[BCM2711_CLOCK_TOTAL]; /*add fixed osc clock*/
+    uint64 _rates[BCM2711_CLOCK_TOTAL];
+    uint64 _rates_valid; /* one bit per clock id */
+    uint16 _users[BCM2711_CLOCK_TOTAL];
+    uint16 _children_on[BCM2711_CLOCK_TOTAL];
+    clk_rate_index _index[BCM2711_CLOCK_TOTAL];
+    uint64 _index_valid; /* one bit per clock id, same invalidation as _rates_valid */
+    /* PLL channels are never re-divided above the rate the firmware gave them */
+    uint64 _channel_max[BCM2711_CLOCK_TOTAL];
+    static_assert(BCM2711_CLOCK_TOTAL <= 64, "rate cache bitmap too small");
+    uint8 _domain[BCM2711_CLOCK_TOTAL];
+    uint8 _mux_domains[BCM2711_CLOCK_TOTAL]; /* mask of the domains of all mux parents */
+    uint64 _dirty; /* one bit per clock id whose snapshot is out of date */
+    uint64 _published;
+    uint64 _idle_delay[BCM2711_CLOCK_TOTAL];
+    uint64 _idle_at[BCM2711_CLOCK_TOTAL]; /* 0 unless the idle timer runs */
+    uint64 _idle_armed;                    /* one bit per clock id the next scan looks at */
+    Pm::Idle_timer _idle_timer;
+    Pm::Stat _stats[CLK_STAT_COUNT];
+    Pm::Seqlock<clk_state> _state[BCM2711_CLOCK_TOTAL];
+    Pm::Spinlock _locks[CLK_DOMAIN_COUNT];
+    Pm::Spinlock _aux_lock;
+    Pm::Spinlock _shared_lock;
+};
+
+/* holds the domain locks of a clock for the scope of an operation on it */
+class clk_guard {
+public:
+    clk_guard(cprman &cprman, uint8 id, bool reroute)
+        : _cprman(cprman), _held(cprman.lock(id, reroute)) {}
+    ~clk_guard() { _cprman.unlock(_held); }
+
+    clk_guard(const clk_guard &) = delete;
+    clk_guard &operator=(const clk_guard &) = delete;
+
+private:
+    cprman &_cprman;
+    uint8 _held;
 };
 
 /**
@@ -451,6 +720,34 @@ public:
 
     virtual ~rpi_clock() {}
 
+    /* clock id of the current parent, unlike get_parent() which may be a mux index */
+    uint8 get_parent_id(void) { return _parent; }
+
+    /* clock id set_parent(idx) would switch to */
+    virtual uint8 mux_parent_id(uint8) { return BCM2711_INVALID; }
+
+    /**
+     * Rate planning hooks. rate_for_parent() is what the clock makes out of
+     * parent_rate with the divisor closest to rate, rounded towards a lower
+     * rate if round_up; set_div() programs such a divisor. A PLL channel
+     * reports the largest integer divider set_rate() can pick in max_div().
+     */
+    virtual uint64 rate_for_parent(uint64, uint64 parent_rate, bool, uint32 &div,
+                                   uint64 &avgrate) {
+        div = 0;
+        avgrate = parent_rate;
+        return parent_rate;
+    }
+
+    virtual Errno set_div(uint32) { return Errno::ENOTSUP; }
+
+    /* lowest and highest rate the divisor allows from parent_rate */
+    virtual void rate_range(uint64 parent_rate, uint64 &min, uint64 &max) {
+        min = max = parent_rate;
+    }
+
+    virtual uint32 max_div(void) { return 0; }
+
 protected:
     uint8 _parent;
     uint64 _rate;
@@ -486,11 +783,15 @@ public:
 
     virtual Errno describe_rate(Pm::clk_desc &desc) override {
         desc.triplet = false;
-        desc.min = static_cast<uint32>(_rate);
+        desc.min = desc.max = static_cast<uint32>(_rate);
+        desc.step = 0;
         return Errno::ENONE;
     }
 
-    bcm2835_fixed_clk(uint64 rate) { _rate = rate; }
+    bcm2835_fixed_clk(uint64 rate) {
+        _rate = rate;
+        _parent = BCM2711_INVALID;
+    }
 };
 
 /**
@@ -525,9 +826,12 @@ public:
 
     uint8 get_parent(void) override;
 
+    /* the feedback divider has A2W_PLL_FRAC_BITS of fraction, so the range is linear */
     Errno describe_rate(Pm::clk_desc &desc) override {
-        desc.triplet = false;
-        desc.min = static_cast<uint32>(get_rate());
+        desc.triplet = true;
+        desc.min = static_cast<uint32>(_data->min_rate);
+        desc.max = static_cast<uint32>(_data->max_rate);
+        desc.step = static_cast<uint32>(_cprman->get_rate(_parent) >> A2W_PLL_FRAC_BITS);
         return Errno::ENONE;
     }
 
@@ -561,11 +865,14 @@ public:
 
     uint8 get_parent(void) override;
 
+    uint32 max_div(void) override { return 1u << A2W_PLL_DIV_BITS; }
+
     void init(cprman *cm) override { _cprman = cm; }
 
     Errno describe_rate(Pm::clk_desc &desc) override {
         desc.triplet = false;
-        desc.min = static_cast<uint32>(get_rate());
+        desc.min = desc.max = static_cast<uint32>(get_rate());
+        desc.step = 0;
         return Errno::ENONE;
     }
 
@@ -582,7 +889,14 @@ public:
 
     long rate_from_divisor(uint64 parent_rate, uint32 div);
 
-    uint64 choose_div_and_prate(uint64 rate, uint32 *div, uint64 *prate, uint64 *avgrate);
+    uint64 rate_for_parent(uint64 rate, uint64 parent_rate, bool round_up, uint32 &div,
+                           uint64 &avgrate) override;
+
+    Errno set_div(uint32 div) override;
+
+    void div_limits(uint32 &mindiv, uint32 &maxdiv);
+
+    void rate_range(uint64 parent_rate, uint64 &min, uint64 &max) override;
 
     bool is_pll(void) override;
 
@@ -604,11 +918,16 @@ public:
 
     uint8 get_parent(void) override;
 
+    uint8 mux_parent_id(uint8 idx) override {
+        return (idx < _data->num_mux_parents) ? _data->parents[idx] : BCM2711_INVALID;
+    }
+
     void init(cprman *cm) override;
 
     Errno describe_rate(Pm::clk_desc &desc) override {
         desc.triplet = false;
-        desc.min = static_cast<uint32>(get_rate());
+        desc.min = desc.max = static_cast<uint32>(get_rate());
+        desc.step = 0;
         return Errno::ENONE;
     }
 
@@ -656,7 +975,8 @@ public:
 
     Errno describe_rate(Pm::clk_desc &desc) override {
         desc.triplet = false;
-        desc.min = static_cast<uint32>(get_rate());
+        desc.min = desc.max = static_cast<uint32>(get_rate());
+        desc.step = 0;
         return Errno::ENONE;
     }
 
@@ -689,7 +1009,7 @@ private:
 
 /*BCM2835_PLLA*/
 const bcm2835_pll_ana_bits plla_ana;
-const struct bcm2835_pll_data plla = {.cm_ctrl_reg = CM_PLLA,
+constexpr struct bcm2835_pll_data plla = {.cm_ctrl_reg = CM_PLLA,
                                       .a2w_ctrl_reg = A2W_PLLA_CTRL,
                                       .frac_reg = A2W_PLLA_FRAC,
                                       .ana_reg_base = A2W_PLLA_ANA0,
@@ -702,7 +1022,7 @@ const struct bcm2835_pll_data plla = {.cm_ctrl_reg = CM_PLLA,
                                       .parent = BCM2711_FIXED_OSC};
 
 /*BCM2835_PLLA_CORE*/
-const struct bcm2835_pll_divider_data plla_core = {
+constexpr struct bcm2835_pll_divider_data plla_core = {
     .cm_reg = CM_PLLA,
     .a2w_reg = A2W_PLLA_CORE,
     .load_mask = CM_PLLA_LOADCORE,
@@ -712,7 +1032,7 @@ const struct bcm2835_pll_divider_data plla_core = {
 };
 
 /*BCM2835_PLLA_PER*/
-const struct bcm2835_pll_divider_data plla_per = {
+constexpr struct bcm2835_pll_divider_data plla_per = {
     .cm_reg = CM_PLLA,
     .a2w_reg = A2W_PLLA_PER,
     .load_mask = CM_PLLA_LOADPER,
@@ -722,7 +1042,7 @@ const struct bcm2835_pll_divider_data plla_per = {
 };
 
 /*BCM2835_PLLA_DSI0*/
-const struct bcm2835_pll_divider_data plla_dsi0 = {
+constexpr struct bcm2835_pll_divider_data plla_dsi0 = {
     .cm_reg = CM_PLLA,
     .a2w_reg = A2W_PLLA_DSI0,
     .load_mask = CM_PLLA_LOADDSI0,
@@ -732,7 +1052,7 @@ const struct bcm2835_pll_divider_data plla_dsi0 = {
 };
 
 /*BCM2835_PLLA_CCP2*/
-const struct bcm2835_pll_divider_data plla_ccp2 = {
+constexpr struct bcm2835_pll_divider_data plla_ccp2 = {
     .cm_reg = CM_PLLA,
     .a2w_reg = A2W_PLLA_CCP2,
     .load_mask = CM_PLLA_LOADCCP2,
@@ -743,7 +1063,7 @@ const struct bcm2835_pll_divider_data plla_ccp2 = {
 
 /*BCM2835_PLLC*/
 const bcm2835_pll_ana_bits pllc_ana;
-const struct bcm2835_pll_data pllc = {
+constexpr struct bcm2835_pll_data pllc = {
     .cm_ctrl_reg = CM_PLLC,
     .a2w_ctrl_reg = A2W_PLLC_CTRL,
     .frac_reg = A2W_PLLC_FRAC,
@@ -758,7 +1078,7 @@ const struct bcm2835_pll_data pllc = {
 };
 
 /*BCM2835_PLLC_CORE1*/
-const struct bcm2835_pll_divider_data pllc_core0 = {
+constexpr struct bcm2835_pll_divider_data pllc_core0 = {
     .cm_reg = CM_PLLC,
     .a2w_reg = A2W_PLLC_CORE0,
     .load_mask = CM_PLLC_LOADCORE0,
@@ -768,7 +1088,7 @@ const struct bcm2835_pll_divider_data pllc_core0 = {
 };
 
 /*BCM2835_PLLC_CORE1*/
-const struct bcm2835_pll_divider_data pllc_core1 = {
+constexpr struct bcm2835_pll_divider_data pllc_core1 = {
     .cm_reg = CM_PLLC,
     .a2w_reg = A2W_PLLC_CORE1,
     .load_mask = CM_PLLC_LOADCORE1,
@@ -778,7 +1098,7 @@ const struct bcm2835_pll_divider_data pllc_core1 = {
 };
 
 /*BCM2835_PLLC_CORE2*/
-const struct bcm2835_pll_divider_data pllc_core2 = {
+constexpr struct bcm2835_pll_divider_data pllc_core2 = {
     .cm_reg = CM_PLLC,
     .a2w_reg = A2W_PLLC_CORE2,
     .load_mask = CM_PLLC_LOADCORE2,
@@ -788,7 +1108,7 @@ const struct bcm2835_pll_divider_data pllc_core2 = {
 };
 
 /*BCM2835_PLLC_PER*/
-const struct bcm2835_pll_divider_data pllc_per = {
+constexpr struct bcm2835_pll_divider_data pllc_per = {
     .cm_reg = CM_PLLC,
     .a2w_reg = A2W_PLLC_PER,
     .load_mask = CM_PLLC_LOADPER,
@@ -799,7 +1119,7 @@ const struct bcm2835_pll_divider_data pllc_per = {
 
 /*BCM2835_PLLD*/
 const bcm2835_pll_ana_bits plld_ana;
-const struct bcm2835_pll_data plld = {
+constexpr struct bcm2835_pll_data plld = {
     .cm_ctrl_reg = CM_PLLD,
     .a2w_ctrl_reg = A2W_PLLD_CTRL,
     .frac_reg = A2W_PLLD_FRAC,
@@ -814,7 +1134,7 @@ const struct bcm2835_pll_data plld = {
 };
 
 /*BCM2835_PLLD_CORE*/
-const struct bcm2835_pll_divider_data plld_core = {
+constexpr struct bcm2835_pll_divider_data plld_core = {
     .cm_reg = CM_PLLD,
     .a2w_reg = A2W_PLLD_CORE,
     .load_mask = CM_PLLD_LOADCORE,
@@ -824,7 +1144,7 @@ const struct bcm2835_pll_divider_data plld_core = {
 };
 
 /*BCM2835_PLLD_PER*/
-const struct bcm2835_pll_divider_data plld_per = {
+constexpr struct bcm2835_pll_divider_data plld_per = {
     .cm_reg = CM_PLLD,
     .a2w_reg = A2W_PLLD_PER,
     .load_mask = CM_PLLD_LOADPER,
@@ -834,7 +1154,7 @@ const struct bcm2835_pll_divider_data plld_per = {
 };
 
 /*BCM2835_PLLD_DSI0*/
-const struct bcm2835_pll_divider_data plld_dsi0 = {
+constexpr struct bcm2835_pll_divider_data plld_dsi0 = {
     .cm_reg = CM_PLLD,
     .a2w_reg = A2W_PLLD_DSI0,
     .load_mask = CM_PLLD_LOADDSI0,
@@ -844,7 +1164,7 @@ const struct bcm2835_pll_divider_data plld_dsi0 = {
 };
 
 /*BCM2835_PLLD_DSI1*/
-const struct bcm2835_pll_divider_data plld_dsi1 = {
+constexpr struct bcm2835_pll_divider_data plld_dsi1 = {
     .cm_reg = CM_PLLD,
     .a2w_reg = A2W_PLLD_DSI1,
     .load_mask = CM_PLLD_LOADDSI1,
@@ -855,7 +1175,7 @@ const struct bcm2835_pll_divider_data plld_dsi1 = {
 
 /*BCM2835_PLLH*/
 const bcm2835_pll_ana_bits pllh_ana(true);
-const struct bcm2835_pll_data pllh = {
+constexpr struct bcm2835_pll_data pllh = {
     .cm_ctrl_reg = CM_PLLH,
     .a2w_ctrl_reg = A2W_PLLH_CTRL,
     .frac_reg = A2W_PLLH_FRAC,
@@ -871,7 +1191,7 @@ const struct bcm2835_pll_data pllh = {
 
 /* One Time Programmable Memory clock.  Maximum 10Mhz. */
 /*BCM2835_CLOCK_OTP*/
-const struct bcm2835_clock_data otp_data {
+constexpr struct bcm2835_clock_data otp_data {
     .parents = {BCM2711_INVALID, BCM2711_FIXED_OSC, BCM2711_INVALID, BCM2711_INVALID},
     .num_mux_parents = 4, .set_rate_parent = 0, .ctl_reg = CM_OTPCTL, .div_reg = CM_OTPDIV,
     .int_bits = 4, .frac_bits = 0, .is_mash_clock = false, .low_jitter = false,
@@ -882,7 +1202,7 @@ const struct bcm2835_clock_data otp_data {
  * bythe watchdog timer and the camera pulse generator.
  */
 /*BCM2835_CLOCK_TIMER*/
-const struct bcm2835_clock_data timer_data {
+constexpr struct bcm2835_clock_data timer_data {
     .parents = {BCM2711_INVALID, BCM2711_FIXED_OSC, BCM2711_INVALID, BCM2711_INVALID},
     .num_mux_parents = 4, .set_rate_parent = 0, .ctl_reg = CM_TIMERCTL, .div_reg = CM_TIMERDIV,
     .int_bits = 6, .frac_bits = 12, .is_mash_clock = false, .low_jitter = false,
@@ -893,14 +1213,14 @@ const struct bcm2835_clock_data timer_data {
  * Generally run at 2Mhz, max 5Mhz.
  */
 /*BCM2835_CLOCK_TSENS*/
-const struct bcm2835_clock_data tsense_data {
+constexpr struct bcm2835_clock_data tsense_data {
     .parents = {BCM2711_INVALID, BCM2711_FIXED_OSC, BCM2711_INVALID, BCM2711_INVALID},
     .num_mux_parents = 4, .set_rate_parent = 0, .ctl_reg = CM_TSENSCTL, .div_reg = CM_TSENSDIV,
     .int_bits = 5, .frac_bits = 0, .is_mash_clock = false, .low_jitter = false,
 };
 
 /*BCM2835_CLOCK_TEC*/
-const struct bcm2835_clock_data tec_data {
+constexpr struct bcm2835_clock_data tec_data {
     .parents = {BCM2711_INVALID, BCM2711_FIXED_OSC, BCM2711_INVALID, BCM2711_INVALID},
     .num_mux_parents = 4, .set_rate_parent = 0, .ctl_reg = CM_TECCTL, .div_reg = CM_TECDIV,
     .int_bits = 6, .frac_bits = 0, .is_mash_clock = false, .low_jitter = false,
@@ -909,7 +1229,7 @@ const struct bcm2835_clock_data tec_data {
 /* clocks with vpu parent mux */
 
 /*BCM2835_CLOCK_H264*/
-const struct bcm2835_clock_data h264_data {
+constexpr struct bcm2835_clock_data h264_data {
     .parents = {BCM2711_INVALID,    BCM2711_FIXED_OSC,  BCM2711_INVALID,   BCM2711_INVALID,
                 BCM2835_PLLA_CORE,  BCM2835_PLLC_CORE0, BCM2835_PLLD_CORE, BCM2711_INVALID,
                 BCM2835_PLLC_CORE1, BCM2835_PLLC_CORE2},
@@ -918,7 +1238,7 @@ const struct bcm2835_clock_data h264_data {
 };
 
 /*BCM2835_CLOCK_ISP*/
-const struct bcm2835_clock_data isp_data {
+constexpr struct bcm2835_clock_data isp_data {
     .parents = {BCM2711_INVALID,    BCM2711_FIXED_OSC,  BCM2711_INVALID,   BCM2711_INVALID,
                 BCM2835_PLLA_CORE,  BCM2835_PLLC_CORE0, BCM2835_PLLD_CORE, BCM2711_INVALID,
                 BCM2835_PLLC_CORE1, BCM2835_PLLC_CORE2},
@@ -931,7 +1251,7 @@ const struct bcm2835_clock_data isp_data {
  * in the SDRAM controller can't be used.
  */
 /*BCM2835_CLOCK_SDRAM*/
-const struct bcm2835_clock_data sdram_data {
+constexpr struct bcm2835_clock_data sdram_data {
     .parents = {BCM2711_INVALID,    BCM2711_FIXED_OSC,  BCM2711_INVALID,   BCM2711_INVALID,
                 BCM2835_PLLA_CORE,  BCM2835_PLLC_CORE0, BCM2835_PLLD_CORE, BCM2711_INVALID,
                 BCM2835_PLLC_CORE1, BCM2835_PLLC_CORE2},
@@ -940,7 +1260,7 @@ const struct bcm2835_clock_data sdram_data {
 };
 
 /*BCM2835_CLOCK_V3D*/
-const struct bcm2835_clock_data v3d_data {
+constexpr struct bcm2835_clock_data v3d_data {
     .parents = {BCM2711_INVALID,    BCM2711_FIXED_OSC,  BCM2711_INVALID,   BCM2711_INVALID,
                 BCM2835_PLLA_CORE,  BCM2835_PLLC_CORE0, BCM2835_PLLD_CORE, BCM2711_INVALID,
                 BCM2835_PLLC_CORE1, BCM2835_PLLC_CORE2},
@@ -955,7 +1275,7 @@ const struct bcm2835_clock_data v3d_data {
  * in various hardware documentation.
  */
 /*BCM2835_CLOCK_VPU*/
-const struct bcm2835_clock_data vpu_data {
+constexpr struct bcm2835_clock_data vpu_data {
     .parents = {BCM2711_INVALID,    BCM2711_FIXED_OSC,  BCM2711_INVALID,   BCM2711_INVALID,
                 BCM2835_PLLA_CORE,  BCM2835_PLLC_CORE0, BCM2835_PLLD_CORE, BCM2711_INVALID,
                 BCM2835_PLLC_CORE1, BCM2835_PLLC_CORE2},
@@ -965,7 +1285,7 @@ const struct bcm2835_clock_data vpu_data {
 
 /* clocks with per parent mux */
 /*BCM2835_CLOCK_AVEO*/
-const struct bcm2835_clock_data aveo_data {
+constexpr struct bcm2835_clock_data aveo_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_AVEOCTL, .div_reg = CM_AVEODIV,
@@ -973,7 +1293,7 @@ const struct bcm2835_clock_data aveo_data {
 };
 
 /*BCM2835_CLOCK_CAM0*/
-const struct bcm2835_clock_data cam0_data {
+constexpr struct bcm2835_clock_data cam0_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_CAM0CTL, .div_reg = CM_CAM0DIV,
@@ -981,7 +1301,7 @@ const struct bcm2835_clock_data cam0_data {
 };
 
 /*BCM2835_CLOCK_CAM1*/
-const struct bcm2835_clock_data cam1_data {
+constexpr struct bcm2835_clock_data cam1_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_CAM1CTL, .div_reg = CM_CAM1DIV,
@@ -989,7 +1309,7 @@ const struct bcm2835_clock_data cam1_data {
 };
 
 /*BCM2835_CLOCK_DFT*/
-const struct bcm2835_clock_data dft_data {
+constexpr struct bcm2835_clock_data dft_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_DFTCTL, .div_reg = CM_DFTDIV,
@@ -997,7 +1317,7 @@ const struct bcm2835_clock_data dft_data {
 };
 
 /*BCM2835_CLOCK_DPI*/
-const struct bcm2835_clock_data dpi_data {
+constexpr struct bcm2835_clock_data dpi_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_DPICTL, .div_reg = CM_DPIDIV,
@@ -1006,7 +1326,7 @@ const struct bcm2835_clock_data dpi_data {
 
 /* Arasan EMMC clock */
 /*BCM2835_CLOCK_EMMC*/
-const struct bcm2835_clock_data emmc_data {
+constexpr struct bcm2835_clock_data emmc_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_EMMCCTL, .div_reg = CM_EMMCDIV,
@@ -1014,7 +1334,7 @@ const struct bcm2835_clock_data emmc_data {
 };
 
 /*BCM2711_CLOCK_EMMC2*/
-const struct bcm2835_clock_data emmc2_data {
+constexpr struct bcm2835_clock_data emmc2_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_EMMC2CTL, .div_reg = CM_EMMC2DIV,
@@ -1023,7 +1343,7 @@ const struct bcm2835_clock_data emmc2_data {
 
 /* General purpose (GPIO) clocks */
 /*BCM2835_CLOCK_GP0*/
-const struct bcm2835_clock_data gp0_data {
+constexpr struct bcm2835_clock_data gp0_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_GP0CTL, .div_reg = CM_GP0DIV,
@@ -1031,7 +1351,7 @@ const struct bcm2835_clock_data gp0_data {
 };
 
 /*BCM2835_CLOCK_GP1*/
-const struct bcm2835_clock_data gp1_data {
+constexpr struct bcm2835_clock_data gp1_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_GP1CTL, .div_reg = CM_GP1DIV,
@@ -1039,7 +1359,7 @@ const struct bcm2835_clock_data gp1_data {
 };
 
 /*BCM2835_CLOCK_GP2*/
-const struct bcm2835_clock_data gp2_data {
+constexpr struct bcm2835_clock_data gp2_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_GP2CTL, .div_reg = CM_GP2DIV,
@@ -1048,7 +1368,7 @@ const struct bcm2835_clock_data gp2_data {
 
 /* HDMI state machine */
 /*BCM2835_CLOCK_HSM*/
-const struct bcm2835_clock_data hsm_data {
+constexpr struct bcm2835_clock_data hsm_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_HSMCTL, .div_reg = CM_HSMDIV,
@@ -1056,7 +1376,7 @@ const struct bcm2835_clock_data hsm_data {
 };
 
 /*BCM2835_CLOCK_PCM*/
-const struct bcm2835_clock_data pcm_data {
+constexpr struct bcm2835_clock_data pcm_data {
     .parents = {BCM2711_INVALID, BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2711_INVALID, BCM2711_INVALID,   BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_PCMCTL, .div_reg = CM_PCMDIV,
@@ -1064,7 +1384,7 @@ const struct bcm2835_clock_data pcm_data {
 };
 
 /*BCM2835_CLOCK_PWM*/
-const struct bcm2835_clock_data pwm_data {
+constexpr struct bcm2835_clock_data pwm_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_PWMCTL, .div_reg = CM_PWMDIV,
@@ -1072,7 +1392,7 @@ const struct bcm2835_clock_data pwm_data {
 };
 
 /*BCM2835_CLOCK_SLIM*/
-const struct bcm2835_clock_data slim_data {
+constexpr struct bcm2835_clock_data slim_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_SLIMCTL, .div_reg = CM_SLIMDIV,
@@ -1080,7 +1400,7 @@ const struct bcm2835_clock_data slim_data {
 };
 
 /*BCM2835_CLOCK_SMI*/
-const struct bcm2835_clock_data smi_data {
+constexpr struct bcm2835_clock_data smi_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_SMICTL, .div_reg = CM_SMIDIV,
@@ -1088,7 +1408,7 @@ const struct bcm2835_clock_data smi_data {
 };
 
 /*BCM2835_CLOCK_UART*/
-const struct bcm2835_clock_data uart_data {
+constexpr struct bcm2835_clock_data uart_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_UARTCTL, .div_reg = CM_UARTDIV,
@@ -1097,7 +1417,7 @@ const struct bcm2835_clock_data uart_data {
 
 /* TV encoder clock.  Only operating frequency is 108Mhz.  */
 /*BCM2835_CLOCK_VEC*/
-const struct bcm2835_clock_data vec_data {
+constexpr struct bcm2835_clock_data vec_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_VECCTL, .div_reg = CM_VECDIV,
@@ -1105,7 +1425,7 @@ const struct bcm2835_clock_data vec_data {
 };
 
 /*BCM2835_CLOCK_DSI0E*/
-const struct bcm2835_clock_data dsi0e_data {
+constexpr struct bcm2835_clock_data dsi0e_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_DSI0ECTL, .div_reg = CM_DSI0EDIV,
@@ -1113,7 +1433,7 @@ const struct bcm2835_clock_data dsi0e_data {
 };
 
 /*BCM2835_CLOCK_DSI1E*/
-const struct bcm2835_clock_data dsi1e_data {
+constexpr struct bcm2835_clock_data dsi1e_data {
     .parents = {BCM2711_INVALID,  BCM2711_FIXED_OSC, BCM2711_INVALID,  BCM2711_INVALID,
                 BCM2835_PLLA_PER, BCM2835_PLLC_PER,  BCM2835_PLLD_PER, BCM2711_INVALID},
     .num_mux_parents = 8, .set_rate_parent = 0, .ctl_reg = CM_DSI1ECTL, .div_reg = CM_DSI1EDIV,
@@ -1127,21 +1447,197 @@ const struct bcm2835_clock_data dsi1e_data {
  * non-stop vpu clock.
  */
 /*BCM2835_CLOCK_PERI_IMAGE*/
-const struct bcm2835_gate_data peri_image_data {
+constexpr struct bcm2835_gate_data peri_image_data {
     .parent = BCM2835_CLOCK_VPU, .ctl_reg = CM_PERIICTL,
 };
 
 /*BCM2711_CLOCK_AUX_UART*/
-const struct bcm2835_gate_data aux_uart_data {
+constexpr struct bcm2835_gate_data aux_uart_data {
     .parent = BCM2835_CLOCK_VPU, .ctl_reg = CM_AUX_GATE,
 };
 
 /*BCM2711_CLOCK_AUX_SPI1*/
-const struct bcm2835_gate_data aux_spi1_data {
+constexpr struct bcm2835_gate_data aux_spi1_data {
     .parent = BCM2835_CLOCK_VPU, .ctl_reg = CM_AUX_GATE,
 };
 
 /*BCM2711_CLOCK_AUX_SPI2*/
-const struct bcm2835_gate_data aux_spi2_data {
+constexpr struct bcm2835_gate_data aux_spi2_data {
     .parent = BCM2835_CLOCK_VPU, .ctl_reg = CM_AUX_GATE,
 };
+
+/**
+ * Static clock topology. Mux clocks list every source they can select, so the
+ * index below is a superset of the live tree: walking it never misses a clock
+ * affected by a change, at the price of visiting some that currently use
+ * another source.
+ */
+#define BCM2711_MAX_CLK_CHILDREN 32
+
+struct clk_topology {
+    uint8 parents[BCM2711_MAX_CLK_PARENTS];
+    uint8 num_parents;
+};
+
+static constexpr clk_topology
+clk_topology_single(uint8 parent) {
+    return {{parent}, 1};
+}
+
+static constexpr clk_topology
+clk_topology_mux(const struct bcm2835_clock_data &data) {
+    clk_topology topo{};
+    for (uint8 i = 0; i < data.num_mux_parents; i++)
+        if (data.parents[i] != BCM2711_INVALID) topo.parents[topo.num_parents++] = data.parents[i];
+    return topo;
+}
+
+/* must list the same clocks cprman::probe instantiates, probe asserts that it does */
+static constexpr clk_topology
+clk_topology_of(uint8 id) {
+    switch (id) {
+    case BCM2835_PLLA:
+        return clk_topology_single(plla.parent);
+    case BCM2835_PLLA_CORE:
+        return clk_topology_single(plla_core.parent);
+    case BCM2835_PLLA_PER:
+        return clk_topology_single(plla_per.parent);
+    case BCM2835_PLLA_DSI0:
+        return clk_topology_single(plla_dsi0.parent);
+    case BCM2835_PLLA_CCP2:
+        return clk_topology_single(plla_ccp2.parent);
+    case BCM2835_PLLC:
+        return clk_topology_single(pllc.parent);
+    case BCM2835_PLLC_CORE0:
+        return clk_topology_single(pllc_core0.parent);
+    case BCM2835_PLLC_CORE1:
+        return clk_topology_single(pllc_core1.parent);
+    case BCM2835_PLLC_CORE2:
+        return clk_topology_single(pllc_core2.parent);
+    case BCM2835_PLLC_PER:
+        return clk_topology_single(pllc_per.parent);
+    case BCM2835_PLLD:
+        return clk_topology_single(plld.parent);
+    case BCM2835_PLLD_CORE:
+        return clk_topology_single(plld_core.parent);
+    case BCM2835_PLLD_PER:
+        return clk_topology_single(plld_per.parent);
+    case BCM2835_PLLD_DSI0:
+        return clk_topology_single(plld_dsi0.parent);
+    case BCM2835_PLLD_DSI1:
+        return clk_topology_single(plld_dsi1.parent);
+    case BCM2835_CLOCK_OTP:
+        return clk_topology_mux(otp_data);
+    case BCM2835_CLOCK_TIMER:
+        return clk_topology_mux(timer_data);
+    case BCM2835_CLOCK_TSENS:
+        return clk_topology_mux(tsense_data);
+    case BCM2835_CLOCK_TEC:
+        return clk_topology_mux(tec_data);
+    case BCM2835_CLOCK_H264:
+        return clk_topology_mux(h264_data);
+    case BCM2835_CLOCK_ISP:
+        return clk_topology_mux(isp_data);
+    case BCM2835_CLOCK_SDRAM:
+        return clk_topology_mux(sdram_data);
+    case BCM2835_CLOCK_V3D:
+        return clk_topology_mux(v3d_data);
+    case BCM2835_CLOCK_VPU:
+        return clk_topology_mux(vpu_data);
+    case BCM2835_CLOCK_AVEO:
+        return clk_topology_mux(aveo_data);
+    case BCM2835_CLOCK_CAM0:
+        return clk_topology_mux(cam0_data);
+    case BCM2835_CLOCK_CAM1:
+        return clk_topology_mux(cam1_data);
+    case BCM2835_CLOCK_DFT:
+        return clk_topology_mux(dft_data);
+    case BCM2835_CLOCK_DPI:
+        return clk_topology_mux(dpi_data);
+    case BCM2835_CLOCK_EMMC:
+        return clk_topology_mux(emmc_data);
+    case BCM2711_CLOCK_EMMC2:
+        return clk_topology_mux(emmc2_data);
+    case BCM2835_CLOCK_GP0:
+        return clk_topology_mux(gp0_data);
+    case BCM2835_CLOCK_GP1:
+        return clk_topology_mux(gp1_data);
+    case BCM2835_CLOCK_GP2:
+        return clk_topology_mux(gp2_data);
+    case BCM2835_CLOCK_HSM:
+        return clk_topology_mux(hsm_data);
+    case BCM2835_CLOCK_PCM:
+        return clk_topology_mux(pcm_data);
+    case BCM2835_CLOCK_PWM:
+        return clk_topology_mux(pwm_data);
+    case BCM2835_CLOCK_SLIM:
+        return clk_topology_mux(slim_data);
+    case BCM2835_CLOCK_SMI:
+        return clk_topology_mux(smi_data);
+    case BCM2835_CLOCK_UART:
+        return clk_topology_mux(uart_data);
+    case BCM2835_CLOCK_VEC:
+        return clk_topology_mux(vec_data);
+    case BCM2835_CLOCK_DSI0E:
+        return clk_topology_mux(dsi0e_data);
+    case BCM2835_CLOCK_DSI1E:
+        return clk_topology_mux(dsi1e_data);
+    case BCM2835_CLOCK_PERI_IMAGE:
+        return clk_topology_single(peri_image_data.parent);
+    case BCM2711_CLOCK_AUX_UART:
+        return clk_topology_single(aux_uart_data.parent);
+    case BCM2711_CLOCK_AUX_SPI1:
+        return clk_topology_single(aux_spi1_data.parent);
+    case BCM2711_CLOCK_AUX_SPI2:
+        return clk_topology_single(aux_spi2_data.parent);
+    default:
+        /* oscillator, firmware owned PLLs and clocks we do not instantiate */
+        return {{}, 0};
+    }
+}
+
+/**
+ * Child adjacency and descendant bitmaps of the clock tree, computed at
+ * compile time from the tables above.
+ */
+class clk_tree_index {
+public:
+    constexpr clk_tree_index() : _children{}, _num_children{}, _descendants{} {
+        for (uint8 id = 0; id < BCM2711_CLOCK_TOTAL; id++) {
+            clk_topology topo = clk_topology_of(id);
+            for (uint8 i = 0; i < topo.num_parents; i++) {
+                uint8 p = topo.parents[i];
+                _children[p][_num_children[p]++] = id;
+            }
+        }
+
+        /* the tree is only a few levels deep, iterate until the bitmaps are stable */
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (uint8 id = 0; id < BCM2711_CLOCK_TOTAL; id++) {
+                uint64 desc = _descendants[id];
+                for (uint8 i = 0; i < _num_children[id]; i++) {
+                    uint8 c = _children[id][i];
+                    desc |= (1ull << c) | _descendants[c];
+                }
+                if (desc != _descendants[id]) {
+                    _descendants[id] = desc;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    constexpr uint8 num_children(uint8 id) const { return _num_children[id]; }
+
+    constexpr uint8 child(uint8 id, uint8 i) const { return _children[id][i]; }
+
+    /* bit n set if clock n can be derived from id, id itself excluded */
+    constexpr uint64 descendants(uint8 id) const { return _descendants[id]; }
+
+private:
+    uint8 _children[BCM2711_CLOCK_TOTAL][BCM2711_MAX_CLK_CHILDREN];
+    uint8 _num_children[BCM2711_CLOCK_TOTAL];
+    uint64 _descendants[BCM2711_CLOCK_TOTAL];
+};
@@ -41,13 +41,114 @@ struct clk_rate_msg {
     uint32 end_tag;
 };
 
+/**
+ * Property message with any number of tags, laid out as described in
+ * rpi_mbox.h. Tags are appended in order and filled in by the caller; the
+ * VPU answers all of them in place, in a single mailbox round-trip.
+ */
+class fw_prop_msg {
+public:
+    fw_prop_msg(void *buf, uint32 size)
+        : _buf(static_cast<uint8 *>(buf)), _size(size), _len(sizeof(struct bcm2835_mbox_hdr)) {
+        hdr()->buf_size = 0;
+        hdr()->code = BCM2835_MBOX_REQ_CODE;
+    }
+
+    struct bcm2835_mbox_hdr *hdr(void) { return reinterpret_cast<struct bcm2835_mbox_hdr *>(_buf); }
+
+    /* nullptr if the tag and the end tag do not fit anymore */
+    template<typename TAG>
+    TAG *add(uint32 tag_id) {
+        uint32 len = (static_cast<uint32>(sizeof(TAG)) + 3u) & ~3u;
+        if (_len + len + sizeof(uint32) > _size) return nullptr;
+
+        TAG *tag = reinterpret_cast<TAG *>(_buf + _len);
+        memset(tag, 0, sizeof(TAG));
+        tag->tag_hdr.tag = tag_id;
+        tag->tag_hdr.val_buf_size = sizeof(tag->body);
+        tag->tag_hdr.val_len = sizeof(tag->body.req);
+        _len += len;
+        return tag;
+    }
+
+    /* terminate the tag list, the message can be posted after this */
+    void finish(void) {
+        *reinterpret_cast<uint32 *>(_buf + _len) = 0;
+        hdr()->buf_size = _len + sizeof(uint32);
+    }
+
+    /* the firmware flags every tag it has processed */
+    template<typename TAG>
+    static bool answered(const TAG *tag) {
+        return tag->tag_hdr.val_len & BCM2835_MBOX_TAG_VAL_LEN_RESPONSE;
+    }
+
+private:
+    uint8 *_buf;
+    uint32 _size;
+    uint32 _len;
+};
+
+/**
+ * The firmware page is carved into fixed size property slots, each one a
+ * request of its own, so several messages can be composed, in flight or
+ * waiting to be collected at the same time. A slot holds the largest
+ * message built here, one tag for every power domain.
+ */
+static constexpr uint32 RPI_FW_SLOT_SIZE = 512;
+static constexpr uint32 RPI_FW_MAX_SLOTS = PAGE_SIZE / RPI_FW_SLOT_SIZE;
+
+static_assert(RPI_FW_SLOT_SIZE % 16 == 0, "the VPU takes 16-byte aligned buffers only");
+static_assert(sizeof(struct bcm2835_mbox_hdr)
+                      + RPI_POWER_DOMAIN_COUNT * sizeof(struct bcm2835_mbox_tag_set_power_state)
+                      + sizeof(uint32)
+                  <= RPI_FW_SLOT_SIZE,
+              "a slot must hold a message for all power domains");
+
 class rpi_fw {
 public:
+    enum fw_req_state : uint8 {
+        FW_REQ_FREE = 0,
+        FW_REQ_OWNED,   /* allocated, the caller composes or reads the message */
+        FW_REQ_PENDING, /* the VPU owns the slot */
+        FW_REQ_DONE,    /* answered, result not collected yet */
+    };
+
+    static constexpr uint8 FW_SLOT_NONE = 0xff;
+
+    struct fw_req {
+        void *buf;
+        uint32 bus_addr;
+        uint32 token;
+        fw_req_state state;
+        uint8 next; /* free list */
+        bool async; /* from alloc_async(), counted in _num_async */
+        Errno err;
+        uint64 posted_at; /* ticks */
+    };
+
+    /* mailbox latency in ticks */
+    enum fw_stat : uint32 {
+        FW_STAT_MSG = 0, /* from post to the answer being seen, any message */
+        FW_STAT_CALL,    /* synchronous calls, waiting for a free mailbox included */
+        FW_STAT_COUNT,
+    };
+
     struct bcm2835_mbox_regs *_mbox;
     void *_buffer;
     void *_buffer_pa;
     uint32 _buf_size;
 
+    fw_req _reqs[RPI_FW_MAX_SLOTS];
+    uint32 _num_slots;
+    uint8 _free;
+    uint32 _num_async;
+    uint32 _next_token;
+    Pm::Stat _stats[FW_STAT_COUNT];
+
+    /* the mailbox FIFOs and the request table, never held while waiting */
+    Pm::Spinlock _lock;
+
     /**
      * VPU is a 32-bit processor, buffer used to communicate with it
      * must be 32-bit addressable
@@ -56,69 +157,210 @@ public:
 
     inline uint64 bus_to_phys(uint64 bus_addr) { return bus_addr & ~0xc0000000; }
 
+    inline uint32 buffer_bus_addr(void) {
+        return static_cast<uint32>(phys_to_bus(reinterpret_cast<uint64>(_buffer_pa)));
+    }
+
+    /* the helpers below expect _lock to be held */
+    fw_req *take_slot(void) {
+        if (_free == FW_SLOT_NONE) return nullptr;
+
+        fw_req *req = &_reqs[_free];
+        _free = req->next;
+        req->state = FW_REQ_OWNED;
+        return req;
+    }
+
+    void put_slot(fw_req *req) {
+        if (req->async) {
+            req->async = false;
+            _num_async--;
+        }
+        req->state = FW_REQ_FREE;
+        req->next = _free;
+        _free = static_cast<uint8>(req - _reqs);
+    }
+
+    /* nullptr when every slot is taken, poll() may free some */
+    fw_req *alloc(void) {
+        Pm::Lock_guard guard(_lock);
+        return take_slot();
+    }
+
     /**
-     * synchronous mailbox interface, used to communicate
-     * the address of the property interface protocol
-     * buffer
+     * a slot for a request whose result is collected later, if any. One slot
+     * is never handed out here, so posted requests nobody collects cannot
+     * starve synchronous calls.
      */
-    Errno call_fw_raw(uint32 &ret) {
-        uint64 buf = phys_to_bus(reinterpret_cast<uint64>(_buffer_pa));
+    fw_req *alloc_async(void) {
+        Pm::Lock_guard guard(_lock);
+        if (_num_async + 1 >= _num_slots) return nullptr;
 
-        if (buf & BCM2835_CHAN_MASK) {
-            return Errno::EINVAL;
+        fw_req *req = take_slot();
+        if (req) {
+            req->async = true;
+            _num_async++;
         }
+        return req;
+    }
+
+    void release(fw_req *req) {
+        Pm::Lock_guard guard(_lock);
+        put_slot(req);
+    }
 
-        /* clear unprocessed firmware responses, if any */
+    /**
+     * waits for requests in flight and for other synchronous callers; nullptr
+     * only if every slot holds a posted request, which alloc_async() prevents
+     */
+    fw_req *alloc_wait(void) {
         while (true) {
-            uint32 val = ind(reinterpret_cast<mword>(&_mbox->mail0_status));
-            if (val & BCM2835_MBOX_STATUS_RD_EMPTY) break;
-            val = ind(reinterpret_cast<mword>(&_mbox->read));
+            {
+                Pm::Lock_guard guard(_lock);
+                fw_req *req = take_slot();
+                if (req) return req;
+
+                bool busy = false;
+                for (uint32 i = 0; i < _num_slots; i++) {
+                    const fw_req &r = _reqs[i];
+                    busy |= (r.state == FW_REQ_PENDING) || (r.state == FW_REQ_OWNED && !r.async);
+                }
+                if (!busy) return nullptr;
+
+                drain();
+            }
+            /* let the EC holding the slot in, it needs the lock to give it back */
+            Pm::relax();
         }
+    }
 
-        /* wait for channel to be free */
-        while (true) {
-            uint32 val = ind(reinterpret_cast<mword>(&_mbox->mail1_status));
-            if (!(val & BCM2835_MBOX_STATUS_WR_FULL)) break;
+    fw_req *find_req(uint32 token) {
+        for (uint32 i = 0; i < _num_slots; i++) {
+            fw_req &r = _reqs[i];
+            if ((r.state == FW_REQ_PENDING || r.state == FW_REQ_DONE) && r.token == token)
+                return &r;
         }
+        return nullptr;
+    }
 
-        /* send command */
-        uint32 data = BCM2835_MBOX_PACK(BCM2835_MBOX_PROP_CHAN, static_cast<uint32>(buf));
-        outd(reinterpret_cast<mword>(&_mbox->write), data);
+    /* the VPU answers with the bus address of the slot it has processed */
+    void complete_req(uint32 bus_addr) {
+        uint32 slot = (bus_addr - buffer_bus_addr()) / RPI_FW_SLOT_SIZE;
+        if (slot >= _num_slots) return;
 
-        /* wait for response */
-        while (true) {
-            uint32 reg = ind(reinterpret_cast<mword>(&_mbox->mail0_status));
-            if (!(reg & BCM2835_MBOX_STATUS_RD_EMPTY)) break;
-        }
+        fw_req &r = _reqs[slot];
+        if (r.state != FW_REQ_PENDING || r.bus_addr != bus_addr) return;
+
+        struct bcm2835_mbox_hdr *hdr = static_cast<struct bcm2835_mbox_hdr *>(r.buf);
+        r.err = (hdr->code == BCM2835_MBOX_RESP_CODE_SUCCESS) ? Errno::ENONE : Errno::ENOTSUP;
+        r.state = FW_REQ_DONE;
+        _stats[FW_STAT_MSG].record(Pm::ticks() - r.posted_at);
+    }
+
+    /**
+     * drain the response FIFO and complete the requests it names. This is
+     * the whole completion path, it can run from the mailbox interrupt or
+     * from any caller that wants to make progress. Responses that match no
+     * request in flight are dropped.
+     */
+    void poll(void) {
+        Pm::Lock_guard guard(_lock);
+        drain();
+    }
 
-        uint32 resp = ind(reinterpret_cast<mword>(&_mbox->read));
-        if (BCM2835_MBOX_UNPACK_CHAN(resp) != BCM2835_MBOX_PROP_CHAN) {
-            return Errno::ENOTSUP; /*response not for our request*/
+    /* poll() with _lock held */
+    void drain(void) {
+        while (!(ind(reinterpret_cast<mword>(&_mbox->mail0_status))
+                 & BCM2835_MBOX_STATUS_RD_EMPTY)) {
+            uint32 resp = ind(reinterpret_cast<mword>(&_mbox->read));
+            if (BCM2835_MBOX_UNPACK_CHAN(resp) != BCM2835_MBOX_PROP_CHAN) continue;
+            complete_req(BCM2835_MBOX_UNPACK_DATA(resp));
         }
+    }
+
+    /**
+     * hand the message in an owned slot to the VPU without waiting for the
+     * answer; token identifies the request for complete(). EBUSY means the
+     * mailbox is full, retry after poll().
+     */
+    Errno post(fw_req *req, uint32 &token) {
+        Pm::Lock_guard guard(_lock);
+        if (req->state != FW_REQ_OWNED) return Errno::EINVAL;
 
-        ret = BCM2835_MBOX_UNPACK_DATA(resp);
+        if (ind(reinterpret_cast<mword>(&_mbox->mail1_status)) & BCM2835_MBOX_STATUS_WR_FULL)
+            return Errno::EBUSY;
+
+        /* the top bit stays clear, callers may use such tokens of their own */
+        req->token = _next_token++ & ~(1u << 31);
+        req->err = Errno::ENONE;
+        req->state = FW_REQ_PENDING;
+        req->posted_at = Pm::ticks();
+
+        uint32 data = BCM2835_MBOX_PACK(BCM2835_MBOX_PROP_CHAN, req->bus_addr);
+        outd(reinterpret_cast<mword>(&_mbox->write), data);
+
+        token = req->token;
         return Errno::ENONE;
     }
 
+    /**
+     * outcome of a posted request: EBUSY while the firmware has not answered,
+     * the firmware status otherwise. The slot is released once its result
+     * has been returned.
+     */
+    Errno complete(uint32 token) {
+        Pm::Lock_guard guard(_lock);
+        drain();
+
+        fw_req *req = find_req(token);
+        if (!req) return Errno::EINVAL;
+        if (req->state == FW_REQ_PENDING) return Errno::EBUSY;
+
+        Errno err = req->err;
+        put_slot(req);
+        return err;
+    }
+
+    Errno post_prop(fw_req *req, uint32 &token) {
+        Errno err;
+        while ((err = post(req, token)) == Errno::EBUSY) {
+            poll();
+            Pm::relax();
+        }
+        return err;
+    }
+
     /**
      * assumption: the buffer passed is non-cached and the
-     * address is physical.
+     * address is physical. The slot stays with the caller, who reads the
+     * answer from it and releases it.
      */
-    Errno call_fw_prop(void) {
-        uint32 resp;
-        Errno err = call_fw_raw(resp);
+    Errno call_fw_prop(fw_req *req) {
+        uint64 start = Pm::ticks();
+        uint32 token;
+        Errno err = post_prop(req, token);
         if (err != Errno::ENONE) return err;
 
-        if (resp != phys_to_bus(reinterpret_cast<uint64>(_buffer_pa))) {
-            return Errno::ETIMEDOUT;
+        /* any EC draining the mailbox may complete it, look under the lock */
+        while (true) {
+            {
+                Pm::Lock_guard guard(_lock);
+                if (req->state != FW_REQ_PENDING) {
+                    req->state = FW_REQ_OWNED;
+                    _stats[FW_STAT_CALL].record(Pm::ticks() - start);
+                    return req->err;
+                }
+                drain();
+            }
+            Pm::relax();
         }
+    }
 
-        struct bcm2835_mbox_hdr *buf = reinterpret_cast<struct bcm2835_mbox_hdr *>(_buffer);
-        if (buf->code != BCM2835_MBOX_RESP_CODE_SUCCESS) {
-            return Errno::ENOTSUP;
-        }
+    const Pm::Stat &stat(uint32 i) { return _stats[i]; }
 
-        return err;
+    void reset_stats(void) {
+        for (auto &s : _stats)
+            s.reset();
     }
 
     rpi_fw(void) {}
@@ -128,54 +370,149 @@ public:
         _buffer = buf_addr;
         _buf_size = buf_size;
         _buffer_pa = buf_paddr;
+        _next_token = 0;
+        _num_async = 0;
+        reset_stats();
+
+        _num_slots = buf_size / RPI_FW_SLOT_SIZE;
+        if (_num_slots > RPI_FW_MAX_SLOTS) _num_slots = RPI_FW_MAX_SLOTS;
+
+        _free = FW_SLOT_NONE;
+        for (uint32 i = _num_slots; i-- > 0;) {
+            _reqs[i].buf = static_cast<uint8 *>(buf_addr) + i * RPI_FW_SLOT_SIZE;
+            _reqs[i].bus_addr = buffer_bus_addr() + i * RPI_FW_SLOT_SIZE;
+            _reqs[i].async = false;
+            put_slot(&_reqs[i]);
+        }
     }
 
     Errno set_gpio(uint32 gpio, uint32 val) {
-        Errno err = Errno::ENONE;
-        struct fw_gpio_msg *msg = reinterpret_cast<struct fw_gpio_msg *>(_buffer);
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        struct fw_gpio_msg *msg = static_cast<struct fw_gpio_msg *>(req->buf);
         BCM2835_MBOX_INIT_HDR(msg);
         BCM2835_MBOX_INIT_TAG(&msg->fw_gpio, SET_GPIO_STATE);
         msg->fw_gpio.body.req.gpio_id = gpio;
         msg->fw_gpio.body.req.state = val;
-        err = call_fw_prop();
+        Errno err = call_fw_prop(req);
+        release(req);
         return err;
     }
 
     Errno set_pin_function(uint32, uint32) { return Errno::ENONE; }
 
     Errno set_power_domain(uint32 pd, uint32 val) {
-        Errno err = Errno::ENONE;
-        struct fw_pd_msg *msg = reinterpret_cast<struct fw_pd_msg *>(_buffer);
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        struct fw_pd_msg *msg = static_cast<struct fw_pd_msg *>(req->buf);
         BCM2835_MBOX_INIT_HDR(msg);
         BCM2835_MBOX_INIT_TAG(&msg->fw_pd, SET_POWER_STATE);
         msg->fw_pd.body.req.device_id = pd;
         msg->fw_pd.body.req.state = val;
-        err = call_fw_prop();
+        Errno err = call_fw_prop(req);
+        release(req);
         return err;
     }
 
-    Errno get_power_domain(uint32 pd) {
-        Errno err = Errno::ENONE;
-        struct fw_pd_msg *msg = reinterpret_cast<struct fw_pd_msg *>(_buffer);
+    /* complete() the token to learn the outcome; EBUSY once the posted slots are taken */
+    Errno post_power_domain(uint32 pd, uint32 val, uint32 &token) {
+        fw_req *req = alloc_async();
+        if (!req) return Errno::EBUSY;
+
+        struct fw_pd_msg *msg = static_cast<struct fw_pd_msg *>(req->buf);
+        BCM2835_MBOX_INIT_HDR(msg);
+        BCM2835_MBOX_INIT_TAG(&msg->fw_pd, SET_POWER_STATE);
+        msg->fw_pd.body.req.device_id = pd;
+        msg->fw_pd.body.req.state = val;
+        Errno err = post_prop(req, token);
+        if (err != Errno::ENONE) release(req);
+        return err;
+    }
+
+    /**
+     * one tag per domain, one round-trip for all of them. state, if given,
+     * receives what the firmware reports for each domain.
+     */
+    Errno set_power_domains(const uint32 *pds, uint32 num, uint32 val, uint32 *state = nullptr) {
+        struct bcm2835_mbox_tag_set_power_state *tags[RPI_POWER_DOMAIN_COUNT];
+
+        if (num > RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
+
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        fw_prop_msg msg(req->buf, RPI_FW_SLOT_SIZE);
+        for (uint32 i = 0; i < num; i++) {
+            tags[i] = msg.add<struct bcm2835_mbox_tag_set_power_state>(
+                BCM2835_MBOX_TAG_SET_POWER_STATE);
+            tags[i]->body.req.device_id = pds[i];
+            tags[i]->body.req.state = val;
+        }
+        msg.finish();
+
+        Errno err = call_fw_prop(req);
+        for (uint32 i = 0; err == Errno::ENONE && i < num; i++) {
+            if (!fw_prop_msg::answered(tags[i])) err = Errno::ENOTSUP;
+            if (state) state[i] = tags[i]->body.resp.state;
+        }
+        release(req);
+        return err;
+    }
+
+    Errno get_power_domains(const uint32 *pds, uint32 num, uint32 *state) {
+        struct bcm2835_mbox_tag_get_power_state *tags[RPI_POWER_DOMAIN_COUNT];
+
+        if (num > RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
+
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        fw_prop_msg msg(req->buf, RPI_FW_SLOT_SIZE);
+        for (uint32 i = 0; i < num; i++) {
+            tags[i] = msg.add<struct bcm2835_mbox_tag_get_power_state>(
+                BCM2835_MBOX_TAG_GET_POWER_STATE);
+            tags[i]->body.req.device_id = pds[i];
+        }
+        msg.finish();
+
+        Errno err = call_fw_prop(req);
+        for (uint32 i = 0; err == Errno::ENONE && i < num; i++) {
+            if (!fw_prop_msg::answered(tags[i])) err = Errno::ENOTSUP;
+            state[i] = tags[i]->body.resp.state;
+        }
+        release(req);
+        return err;
+    }
+
+    Errno get_power_domain(uint32 pd, uint32 &state) {
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        struct fw_pd_msg *msg = static_cast<struct fw_pd_msg *>(req->buf);
         BCM2835_MBOX_INIT_HDR(msg);
         BCM2835_MBOX_INIT_TAG(&msg->fw_pd, GET_POWER_STATE);
         msg->fw_pd.body.req.device_id = pd;
-        err = call_fw_prop();
-        if (msg->fw_pd.body.resp.state != 0) return Errno::ENOTSUP;
+        Errno err = call_fw_prop(req);
+        state = msg->fw_pd.body.resp.state;
+        release(req);
         return err;
     }
 
     Errno get_clk_rate(uint32 clk_id) {
-        Errno err = Errno::ENONE;
-        struct clk_rate_msg *msg = reinterpret_cast<struct clk_rate_msg *>(_buffer);
+        fw_req *req = alloc_wait();
+        if (!req) return Errno::ENOMEM;
+
+        struct clk_rate_msg *msg = static_cast<struct clk_rate_msg *>(req->buf);
         BCM2835_MBOX_INIT_HDR(msg);
         BCM2835_MBOX_INIT_TAG(&msg->fw_clk, GET_POWER_STATE);
         msg->fw_clk.body.req.clock_id = clk_id;
         msg->fw_clk.body.resp.rate_hz = 0;
-        err = call_fw_prop();
-
-        if (msg->fw_clk.body.resp.rate_hz == 0) return Errno::ENOTSUP;
+        Errno err = call_fw_prop(req);
 
+        if (err == Errno::ENONE && msg->fw_clk.body.resp.rate_hz == 0) err = Errno::ENOTSUP;
+        release(req);
         return err;
     }
 };
@@ -11,6 +11,20 @@
 #define NUM_GPIO 58 /*0-57*/
 
 class rpi_pinctrl {
+public:
+    static constexpr uint32 NUM_FSEL_REGS = (NUM_GPIO + 9) / 10;
+    static constexpr uint32 NUM_BANKS = (NUM_GPIO + 31) / 32;
+
+    /**
+     * What lock-free readers see of a bank: the function select words and
+     * the level we last drove the outputs to. Republished by the writers
+     * under the bank lock.
+     */
+    struct bank_state {
+        uint32 level;
+        uint32 fsel[NUM_FSEL_REGS]; /* only the bank's own pins are meaningful */
+    };
+
 private:
     /*register offsets for 32-Bit accesses*/
     enum {
@@ -82,40 +96,205 @@ private:
     static constexpr uint32 GPIO_REG_SHIFT_MASK = 0x1f;
     static constexpr uint32 GPIO_SHIFT(uint32 pin) { return ((pin)&GPIO_REG_SHIFT_MASK); }
 
+    static constexpr uint32 NUM_PUP_PDN_REGS = (NUM_GPIO + 15) / 16;
+
+    /* detect enable register of every Pm::iotrig bit, in bit order */
+    static constexpr uint32 NUM_TRIGS = 6;
+    static constexpr uint32 TRIG_REG[NUM_TRIGS] = {GPHEN0, GPLEN0, GPREN0,
+                                                   GPFEN0, GPAREN0, GPAFEN0};
+    static constexpr uint32 TRIG_IDX(uint32 trig) { return __builtin_ctz(trig); }
+
+    /* pending masked update of one register, built up by the bulk operations */
+    struct reg_update {
+        uint32 mask;
+        uint32 val;
+
+        void set_field(uint32 field_mask, uint32 shift, uint32 field) {
+            mask |= field_mask << shift;
+            val = (val & ~(field_mask << shift)) | ((field & field_mask) << shift);
+        }
+    };
+
     mword _base;
 
+    /**
+     * Shadow copies of the function select, pull and detect enable registers.
+     * Nobody else writes them once we own the block, so they are read once at
+     * probe and every update becomes an in-memory edit followed by a single
+     * write.
+     */
+    uint32 _fsel[NUM_FSEL_REGS];
+    uint32 _pup_pdn[NUM_PUP_PDN_REGS];
+    uint32 _trig[NUM_TRIGS][NUM_BANKS];
+
+    /* events taken from GPEDS by the interrupt that nobody subscribed to */
+    uint32 _evt_latch[NUM_BANKS];
+
+    /**
+     * Pins whose level detect enables are off in the hardware, though set in
+     * _trig, because the event they raised has not been handled yet. A held
+     * level would otherwise raise its event again right after every ack.
+     */
+    uint32 _lvl_masked[NUM_BANKS];
+
+    static constexpr bool IS_LEVEL_TRIG(uint32 t) {
+        return ((1u << t) & (Pm::iotrig::LEVEL_HIGH | Pm::iotrig::LEVEL_LOW)) != 0;
+    }
+
+    /* what the detect enable register of trigger t holds, under the bank lock */
+    uint32 trig_reg(uint32 t, uint32 b) const {
+        return IS_LEVEL_TRIG(t) ? (_trig[t][b] & ~_lvl_masked[b]) : _trig[t][b];
+    }
+
+    /* under the bank lock, writes only the level enables that change */
+    void set_level_mask(uint32 b, uint32 masked) {
+        uint32 changed = masked ^ _lvl_masked[b];
+        __atomic_store_n(&_lvl_masked[b], masked, __ATOMIC_RELAXED);
+        for (uint32 t = 0; t < NUM_TRIGS; t++) {
+            if (!IS_LEVEL_TRIG(t) || !(_trig[t][b] & changed)) continue;
+            outd(_base + TRIG_REG[t] + b * 4, trig_reg(t, b));
+        }
+    }
+
+    /**
+     * One lock per 32-pin register bank for the read-modify-write registers.
+     * GPFSEL3 holds pins of both banks and takes both locks. GPCLR and GPEDS
+     * are write-one registers; GPSET/GPCLR still take it to keep the level
+     * snapshot in step.
+     */
+    Pm::Spinlock _bank_lock[NUM_BANKS];
+
+    static constexpr uint32 BANK_BIT(uint32 pin) { return 1u << (pin / 32); }
+
+    static constexpr uint32 FSEL_BANKS(uint32 reg) {
+        uint32 last = reg * 10 + 9;
+        return BANK_BIT(reg * 10) | BANK_BIT((last < NUM_GPIO) ? last : NUM_GPIO - 1);
+    }
+
+    void lock_banks(uint32 banks) {
+        for (uint32 i = 0; i < NUM_BANKS; i++)
+            if (banks & (1u << i)) _bank_lock[i].lock();
+    }
+
+    void unlock_banks(uint32 banks) {
+        for (uint32 i = NUM_BANKS; i-- > 0;)
+            if (banks & (1u << i)) _bank_lock[i].unlock();
+    }
+
+    Pm::Seqlock<bank_state> _state[NUM_BANKS];
+    bank_state _bank[NUM_BANKS]; /* writers' copy, under the bank lock */
+
+    void publish(uint32 banks) {
+        for (uint32 b = 0; b < NUM_BANKS; b++)
+            if (banks & (1u << b)) _state[b].write(_bank[b]);
+    }
+
+    /* after a GPFSEL change, the functions are taken from the shadow */
+    void publish_func(uint32 banks) {
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            if (!(banks & (1u << b))) continue;
+            for (uint32 i = 0; i < NUM_FSEL_REGS; i++)
+                _bank[b].fsel[i] = _fsel[i];
+        }
+        publish(banks);
+    }
+
+    static uint32 func_of(const bank_state &st, uint32 pin) {
+        return (st.fsel[pin / 10] >> GPIO_FSEL_SHIFT(pin)) & GPIO_FSEL_MASK;
+    }
+
+    void write_shadow(uint32 reg, uint32 &shadow, const reg_update &upd) {
+        if (!upd.mask) return;
+        shadow = (shadow & ~upd.mask) | upd.val;
+        outd((_base + reg), shadow);
+    }
+
+    /**
+     * Validate pins in order and hand the good ones to merge. status gets one
+     * entry per visited pin, num_done the number of pins visited.
+     */
+    template<typename MERGE>
+    Errno collect(Pm::Pin *pins, uint32 num_pins, uint32 *status, bool stop_on_error,
+                  uint32 &num_done, MERGE merge) {
+        Errno ret = Errno::ENONE;
+
+        for (num_done = 0; num_done < num_pins;) {
+            Pm::Pin &pin = pins[num_done];
+            Errno err = (pin.id < NUM_GPIO) ? Errno::ENONE : Errno::EINVAL;
+
+            if (err == Errno::ENONE) merge(pin);
+            status[num_done++] = static_cast<uint32>(err);
+            if (err == Errno::ENONE) continue;
+
+            if (ret == Errno::ENONE) ret = err;
+            if (stop_on_error) break;
+        }
+        return ret;
+    }
+
 public:
-    rpi_pinctrl() { _base = 0; }
+    bank_state state(uint32 bank) const { return _state[bank].read(); }
+
+    rpi_pinctrl() {
+        _base = 0;
+        for (uint32 i = 0; i < NUM_BANKS; i++)
+            _bank[i] = {};
+        for (uint32 i = 0; i < NUM_FSEL_REGS; i++)
+            _fsel[i] = 0;
+        for (uint32 i = 0; i < NUM_PUP_PDN_REGS; i++)
+            _pup_pdn[i] = 0;
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            for (uint32 t = 0; t < NUM_TRIGS; t++)
+                _trig[t][b] = 0;
+            _evt_latch[b] = 0;
+            _lvl_masked[b] = 0;
+        }
+    }
 
     Errno probe(mword base) {
         _base = base;
+        for (uint32 i = 0; i < NUM_FSEL_REGS; i++)
+            _fsel[i] = ind(_base + GPFSEL0 + i * 4);
+        for (uint32 i = 0; i < NUM_PUP_PDN_REGS; i++)
+            _pup_pdn[i] = ind(_base + GPIO_PUP_PDN_CNTRL_REG0 + i * 4);
+        for (uint32 i = 0; i < NUM_BANKS; i++)
+            _bank[i].level = ind(_base + GPLEV0 + i * 4);
+        for (uint32 t = 0; t < NUM_TRIGS; t++)
+            for (uint32 b = 0; b < NUM_BANKS; b++)
+                _trig[t][b] = ind(_base + TRIG_REG[t] + b * 4);
+        publish_func((1u << NUM_BANKS) - 1);
         return Errno::ENONE;
     }
 
     Errno set_pin_function(uint32 pin, uint32 val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
-        outd((_base + GPIO_FSEL_REG(pin)), ((val & GPIO_FSEL_MASK) << GPIO_FSEL_SHIFT(pin)));
+        reg_update upd = {};
+        upd.set_field(GPIO_FSEL_MASK, GPIO_FSEL_SHIFT(pin), val);
+        lock_banks(FSEL_BANKS(pin / 10));
+        write_shadow(GPIO_FSEL_REG(pin), _fsel[pin / 10], upd);
+        publish_func(FSEL_BANKS(pin / 10));
+        unlock_banks(FSEL_BANKS(pin / 10));
         return Errno::ENONE;
     }
 
     Errno get_pin_function(uint32 pin, uint32 &val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
-        uint32 reg = ind(_base + GPIO_FSEL_REG(pin));
-        val = (reg >> GPIO_FSEL_SHIFT(pin)) & GPIO_FSEL_MASK;
+        val = func_of(_state[pin / 32].read(), pin);
         return Errno::ENONE;
     }
 
     Errno set_pin_pad(uint32 pin, uint32 val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
-        outd((_base + GPIO_PUP_PDN_REG(pin)),
-             ((val & GPIO_PUP_PDN_MASK) << GPIO_PUP_PDN_SHIFT(pin)));
+        reg_update upd = {};
+        upd.set_field(GPIO_PUP_PDN_MASK, GPIO_PUP_PDN_SHIFT(pin), val);
+        Pm::Lock_guard guard(_bank_lock[pin / 32]);
+        write_shadow(GPIO_PUP_PDN_REG(pin), _pup_pdn[pin / 16], upd);
         return Errno::ENONE;
     }
 
     Errno get_pin_pad(uint32 pin, uint32 &val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
-        uint32 reg = ind(_base + GPIO_PUP_PDN_REG(pin));
-        val = (reg >> GPIO_PUP_PDN_SHIFT(pin)) & GPIO_PUP_PDN_MASK;
+        val = (_pup_pdn[pin / 16] >> GPIO_PUP_PDN_SHIFT(pin)) & GPIO_PUP_PDN_MASK;
         return Errno::ENONE;
     }
 
@@ -123,12 +302,97 @@ public:
         if (pin >= NUM_GPIO) return Errno::EINVAL;
         /* check if set or clear */
         uint8 base_reg = (val > 0) ? GPSET0 : GPCLR0;
-        outd((_base + GPIO_REG(base_reg, pin)), (1u << (pin & GPIO_REG_SHIFT_MASK)));
+        uint32 bit = 1u << GPIO_SHIFT(pin);
+        Pm::Lock_guard guard(_bank_lock[pin / 32]);
+        outd((_base + GPIO_REG(base_reg, pin)), bit);
+        uint32 &level = _bank[pin / 32].level;
+        level = (val > 0) ? (level | bit) : (level & ~bit);
+        publish(BANK_BIT(pin));
         return Errno::ENONE;
     }
 
+    /**
+     * Bulk variants of the setters. Pins are grouped by the register they
+     * live in and every touched register is written once, so a whole header
+     * configuration costs one access per GPFSEL/pull register and one
+     * GPSET/GPCLR pair per bank. Outputs of a bank change together.
+     */
+    Errno set_pin_function_bulk(Pm::Pin *pins, uint32 num_pins, uint32 *status,
+                                bool stop_on_error, uint32 &num_done) {
+        reg_update regs[NUM_FSEL_REGS] = {};
+        Errno err = collect(pins, num_pins, status, stop_on_error, num_done, [&](Pm::Pin &pin) {
+            regs[pin.id / 10].set_field(GPIO_FSEL_MASK, GPIO_FSEL_SHIFT(pin.id), pin.val);
+        });
+
+        uint32 banks = 0;
+        for (uint32 i = 0; i < NUM_FSEL_REGS; i++)
+            if (regs[i].mask) banks |= FSEL_BANKS(i);
+
+        lock_banks(banks);
+        for (uint32 i = 0; i < NUM_FSEL_REGS; i++)
+            write_shadow(GPFSEL0 + i * 4, _fsel[i], regs[i]);
+        publish_func(banks);
+        unlock_banks(banks);
+        return err;
+    }
+
+    Errno set_pin_pad_bulk(Pm::Pin *pins, uint32 num_pins, uint32 *status, bool stop_on_error,
+                           uint32 &num_done) {
+        reg_update regs[NUM_PUP_PDN_REGS] = {};
+        Errno err = collect(pins, num_pins, status, stop_on_error, num_done, [&](Pm::Pin &pin) {
+            regs[pin.id / 16].set_field(GPIO_PUP_PDN_MASK, GPIO_PUP_PDN_SHIFT(pin.id), pin.val);
+        });
+
+        /* 16 pins per register, none of them straddles a bank */
+        uint32 banks = 0;
+        for (uint32 i = 0; i < NUM_PUP_PDN_REGS; i++)
+            if (regs[i].mask) banks |= BANK_BIT(i * 16);
+
+        lock_banks(banks);
+        for (uint32 i = 0; i < NUM_PUP_PDN_REGS; i++)
+            write_shadow(GPIO_PUP_PDN_CNTRL_REG0 + i * 4, _pup_pdn[i], regs[i]);
+        unlock_banks(banks);
+        return err;
+    }
+
+    Errno set_gpio_bulk(Pm::Pin *pins, uint32 num_pins, uint32 *status, bool stop_on_error,
+                        uint32 &num_done) {
+        uint32 set[NUM_BANKS] = {}, clr[NUM_BANKS] = {};
+        Errno err = collect(pins, num_pins, status, stop_on_error, num_done, [&](Pm::Pin &pin) {
+            uint32 bit = 1u << GPIO_SHIFT(pin.id);
+            /* a pin listed twice ends up in the state of its last entry */
+            if (pin.val > 0) {
+                set[pin.id / 32] |= bit;
+                clr[pin.id / 32] &= ~bit;
+            } else {
+                clr[pin.id / 32] |= bit;
+                set[pin.id / 32] &= ~bit;
+            }
+        });
+
+        uint32 banks = 0;
+        for (uint32 i = 0; i < NUM_BANKS; i++)
+            if (set[i] | clr[i]) banks |= 1u << i;
+
+        lock_banks(banks);
+        for (uint32 i = 0; i < NUM_BANKS; i++) {
+            if (set[i]) outd((_base + GPSET0 + i * 4), set[i]);
+            if (clr[i]) outd((_base + GPCLR0 + i * 4), clr[i]);
+            _bank[i].level = (_bank[i].level | set[i]) & ~clr[i];
+        }
+        publish(banks);
+        unlock_banks(banks);
+        return err;
+    }
+
+    /* outputs come from the snapshot, only inputs need the pad level */
     Errno get_gpio(uint32 pin, uint32 &val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
+        bank_state st = _state[pin / 32].read();
+        if (func_of(st, pin) == GPIO_OUT) {
+            val = (st.level >> GPIO_SHIFT(pin)) & 1u;
+            return Errno::ENONE;
+        }
         uint32 reg = ind(_base + GPIO_REG(GPLEV0, pin));
         val = (reg >> (pin & GPIO_REG_SHIFT_MASK)) & 1u;
         return Errno::ENONE;
@@ -137,87 +401,171 @@ public:
     Errno set_gpio_trigger(uint32 pin, uint32 val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
         bool is_clr = (val & Pm::iotrig::TRIG_CLR) > 0;
-        uint32 reg;
-        Errno err = Errno::ENONE;
-        switch (val & Pm::iotrig::TRIG_MASK) {
-        case Pm::iotrig::TRIG_NONE:
-            /* clear all triggers ?*/
-            break;
-
-        case Pm::iotrig::LEVEL_HIGH:
-            reg = ind(_base + GPIO_REG(GPHEN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPHEN0, pin)), reg);
-            break;
-        case Pm::iotrig::LEVEL_LOW:
-            reg = ind(_base + GPIO_REG(GPLEN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPLEN0, pin)), reg);
-            break;
-        case Pm::iotrig::EDGE_FALL:
-            reg = ind(_base + GPIO_REG(GPFEN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPFEN0, pin)), reg);
-            break;
-        case Pm::iotrig::EDGE_RISE:
-            reg = ind(_base + GPIO_REG(GPREN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPREN0, pin)), reg);
-            break;
-        case Pm::iotrig::EDGE_FALL_ASYNC:
-            reg = ind(_base + GPIO_REG(GPAFEN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPAFEN0, pin)), reg);
-            break;
-        case Pm::iotrig::EDGE_RISE_ASYNC:
-            reg = ind(_base + GPIO_REG(GPAREN0, pin));
-            reg = is_clr ? (reg & ~(1u << GPIO_SHIFT(pin))) : (reg | (1u << GPIO_SHIFT(pin)));
-            outd((_base + GPIO_REG(GPAREN0, pin)), reg);
-            break;
-        default:
-            return Errno::EINVAL;
-            break;
-        }
-        return err;
+        uint32 trig = val & Pm::iotrig::TRIG_MASK;
+
+        /* clear all triggers ?*/
+        if (trig == Pm::iotrig::TRIG_NONE) return Errno::ENONE;
+        /* one trigger per request */
+        if (trig & (trig - 1)) return Errno::EINVAL;
+        uint32 t = TRIG_IDX(trig);
+        if (t >= NUM_TRIGS) return Errno::EINVAL;
+
+        uint32 b = pin / 32, bit = 1u << GPIO_SHIFT(pin);
+        Pm::Lock_guard guard(_bank_lock[b]);
+        uint32 &reg = _trig[t][b];
+        reg = is_clr ? (reg & ~bit) : (reg | bit);
+        /* configuring a level trigger re-arms the pin */
+        if (IS_LEVEL_TRIG(t)) set_level_mask(b, _lvl_masked[b] & ~bit);
+        outd((_base + GPIO_REG(TRIG_REG[t], pin)), trig_reg(t, b));
+        return Errno::ENONE;
     }
 
     Errno get_gpio_trigger(uint32 pin, uint32 &val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
-        uint32 reg;
         val = Pm::iotrig::TRIG_NONE;
-
-        reg = ind(_base + GPIO_REG(GPHEN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::LEVEL_HIGH;
-
-        reg = ind(_base + GPIO_REG(GPLEN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::LEVEL_LOW;
-
-        reg = ind(_base + GPIO_REG(GPFEN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::EDGE_FALL;
-
-        reg = ind(_base + GPIO_REG(GPREN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::EDGE_RISE;
-
-        reg = ind(_base + GPIO_REG(GPAFEN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::EDGE_FALL_ASYNC;
-
-        reg = ind(_base + GPIO_REG(GPAREN0, pin));
-        if ((reg >> GPIO_SHIFT(pin)) & 1) val |= Pm::iotrig::EDGE_RISE_ASYNC;
-
+        for (uint32 t = 0; t < NUM_TRIGS; t++)
+            if ((_trig[t][pin / 32] >> GPIO_SHIFT(pin)) & 1) val |= 1u << t;
         return Errno::ENONE;
     }
 
+    /* includes events the interrupt took on behalf of polling clients */
     Errno get_gpio_event(uint32 pin, uint32 &val) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
         uint32 reg;
         reg = ind(_base + GPIO_REG(GPEDS0, pin));
+        reg |= __atomic_load_n(&_evt_latch[pin / 32], __ATOMIC_RELAXED);
         val = (reg >> GPIO_SHIFT(pin)) & 1;
         return Errno::ENONE;
     }
 
     Errno clr_gpio_event(uint32 pin) {
         if (pin >= NUM_GPIO) return Errno::EINVAL;
+        __atomic_fetch_and(&_evt_latch[pin / 32], ~(1u << GPIO_SHIFT(pin)), __ATOMIC_RELAXED);
         outd((_base + GPIO_REG(GPEDS0, pin)), (1u << GPIO_SHIFT(pin)));
+        unmask_levels(1ull << pin);
+        return Errno::ENONE;
+    }
+
+    /**
+     * Whole-bank variants, bit n of a mask is GPIO n. Every bank costs at
+     * most one access to the register in question, trigger enables come
+     * from the shadows.
+     */
+    static constexpr uint64 GPIO_VALID_MASK = (1ull << NUM_GPIO) - 1;
+
+    Errno get_gpio_mask(uint64 &levels) {
+        levels = 0;
+        for (uint32 b = 0; b < NUM_BANKS; b++)
+            levels |= static_cast<uint64>(ind(_base + GPLEV0 + b * 4)) << (b * 32);
+        return Errno::ENONE;
+    }
+
+    Errno set_gpio_mask(uint64 set, uint64 clr) {
+        if (((set | clr) & ~GPIO_VALID_MASK) || (set & clr)) return Errno::EINVAL;
+
+        uint32 banks = 0;
+        for (uint32 b = 0; b < NUM_BANKS; b++)
+            if (static_cast<uint32>((set | clr) >> (b * 32))) banks |= 1u << b;
+
+        lock_banks(banks);
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            uint32 high = static_cast<uint32>(set >> (b * 32));
+            uint32 low = static_cast<uint32>(clr >> (b * 32));
+            if (high) outd((_base + GPSET0 + b * 4), high);
+            if (low) outd((_base + GPCLR0 + b * 4), low);
+            _bank[b].level = (_bank[b].level | high) & ~low;
+        }
+        publish(banks);
+        unlock_banks(banks);
+        return Errno::ENONE;
+    }
+
+    Errno get_gpio_event_mask(uint64 &events) {
+        events = 0;
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            uint32 reg = ind(_base + GPEDS0 + b * 4);
+            reg |= __atomic_load_n(&_evt_latch[b], __ATOMIC_RELAXED);
+            events |= static_cast<uint64>(reg) << (b * 32);
+        }
+        return Errno::ENONE;
+    }
+
+    Errno clr_gpio_event_mask(uint64 events) {
+        if (events & ~GPIO_VALID_MASK) return Errno::EINVAL;
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            uint32 bits = static_cast<uint32>(events >> (b * 32));
+            if (!bits) continue;
+            __atomic_fetch_and(&_evt_latch[b], ~bits, __ATOMIC_RELAXED);
+            outd((_base + GPEDS0 + b * 4), bits);
+        }
+        unmask_levels(events);
+        return Errno::ENONE;
+    }
+
+    Errno get_gpio_trigger_mask(uint32 trig, uint64 &pins) {
+        if (!trig || (trig & (trig - 1)) || TRIG_IDX(trig) >= NUM_TRIGS) return Errno::EINVAL;
+        pins = 0;
+        for (uint32 b = 0; b < NUM_BANKS; b++)
+            pins |= static_cast<uint64>(_trig[TRIG_IDX(trig)][b]) << (b * 32);
         return Errno::ENONE;
     }
+
+    /**
+     * Interrupt side: read and ack every pending event of a bank, one GPEDS
+     * read and one write-back. level is the pad level right after, which
+     * tells the edge of pins that trigger on both. Level triggers are masked
+     * before the ack, see mask_levels().
+     */
+    uint32 take_events(uint32 bank, uint32 &level) {
+        uint32 evts = ind(_base + GPEDS0 + bank * 4);
+        if (!evts) return 0;
+        mask_levels(bank, evts);
+        outd((_base + GPEDS0 + bank * 4), evts);
+        level = ind(_base + GPLEV0 + bank * 4);
+        return evts;
+    }
+
+    /**
+     * mask the level detect enables of pins whose event was just taken, until
+     * unmask_levels() says it has been handled; other pins are left alone
+     */
+    void mask_levels(uint32 bank, uint32 pins) {
+        Pm::Lock_guard guard(_bank_lock[bank]);
+        uint32 level = 0;
+        for (uint32 t = 0; t < NUM_TRIGS; t++)
+            if (IS_LEVEL_TRIG(t)) level |= _trig[t][bank];
+        if (pins & level & ~_lvl_masked[bank])
+            set_level_mask(bank, _lvl_masked[bank] | (pins & level));
+    }
+
+    /* a level that is still asserted raises its event again right away */
+    void unmask_levels(uint64 pins) {
+        for (uint32 b = 0; b < NUM_BANKS; b++) {
+            uint32 bits = static_cast<uint32>(pins >> (b * 32));
+            if (!(bits & __atomic_load_n(&_lvl_masked[b], __ATOMIC_RELAXED))) continue;
+
+            Pm::Lock_guard guard(_bank_lock[b]);
+            set_level_mask(b, _lvl_masked[b] & ~bits);
+        }
+    }
+
+    /* keep taken events visible to PM_GET_GPIOEVT until PM_CLR_GPIOEVT */
+    void latch_events(uint32 bank, uint32 evts) {
+        if (evts) __atomic_fetch_or(&_evt_latch[bank], evts, __ATOMIC_RELAXED);
+    }
+
+    /* the enabled trigger that explains an event on pin, given the level after it */
+    uint32 event_trigger(uint32 pin, uint32 level) const {
+        uint32 b = pin / 32, bit = 1u << GPIO_SHIFT(pin);
+        auto enabled = [&](uint32 trig) { return (_trig[TRIG_IDX(trig)][b] & bit) != 0; };
+        bool high = (level & bit) != 0;
+        bool rise = enabled(Pm::iotrig::EDGE_RISE) || enabled(Pm::iotrig::EDGE_RISE_ASYNC);
+        bool fall = enabled(Pm::iotrig::EDGE_FALL) || enabled(Pm::iotrig::EDGE_FALL_ASYNC);
+
+        if (high && enabled(Pm::iotrig::LEVEL_HIGH)) return Pm::iotrig::LEVEL_HIGH;
+        if (!high && enabled(Pm::iotrig::LEVEL_LOW)) return Pm::iotrig::LEVEL_LOW;
+        if (rise && (high || !fall)) return Pm::iotrig::EDGE_RISE;
+        if (fall) return Pm::iotrig::EDGE_FALL;
+        return Pm::iotrig::TRIG_NONE;
+    }
 };
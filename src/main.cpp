@@ -9,126 +9,319 @@
 
 static Rpi4 drv;
 
-/*get our UTCB mapped here*/
+/*get our UTCBs mapped here, one page per CPU*/
 static mword UTCB_BASE = (DEV_MMIO_END + PAGE_SIZE);
 
-PBL_PORTAL(rpi4_srv, mword, Mtd, Pbl::Utcb *) {
+static inline mword
+utcb_va(Cpu cpu) {
+    return UTCB_BASE + cpu * PAGE_SIZE;
+}
 
-    drv_ipc::header *hdr = reinterpret_cast<drv_ipc::header *>(UTCB_BASE);
+/*
+ * One handler per method of drv_ipc::def, the argument and reply types come
+ * from there. Both overlay the same UTCB page: read everything needed from in
+ * before the first write to out. cpu is the CPU whose portal the client called.
+ * The driver has no timer of its own: the methods that release clocks or nodes
+ * expire idle timers, and the pin control ones re-arm consumed level triggers,
+ * so the other methods never pay for either.
+ */
+template<drv_ipc::method M>
+static mword handle(Cpu cpu, typename drv_ipc::def<M>::in &in,
+                    typename drv_ipc::def<M>::out &out);
 
-    switch (hdr->id) {
-    case drv_ipc::method::CLK_IS_ENABLED: {
-        drv_ipc::clk_is_enabled_args *in
-            = reinterpret_cast<drv_ipc::clk_is_enabled_args *>(UTCB_BASE);
-        drv_ipc::clk_is_enabled_ret *out
-            = reinterpret_cast<drv_ipc::clk_is_enabled_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        if (drv.is_clk_enabled(in->clk_id))
-            out->enabled = 1;
-        else
-            out->enabled = 0;
-        return out->size();
-    }
-    case drv_ipc::method::CLK_GET_MAX: {
-        drv_ipc::clk_get_max_ret *out = reinterpret_cast<drv_ipc::clk_get_max_ret *>(UTCB_BASE);
-        out->max_id = drv.get_max_clkid();
-        out->errno = ENONE;
-        return out->size();
-    }
-    case drv_ipc::method::CLK_ENABLE: {
-        drv_ipc::clk_enable_args *in = reinterpret_cast<drv_ipc::clk_enable_args *>(UTCB_BASE);
-        drv_ipc::clk_enable_ret *out = reinterpret_cast<drv_ipc::clk_enable_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.enable_clk(in->clk_id);
-        return out->size();
-    }
-    case drv_ipc::method::CLK_DISABLE: {
-        drv_ipc::clk_disable_args *in = reinterpret_cast<drv_ipc::clk_disable_args *>(UTCB_BASE);
-        drv_ipc::clk_disable_ret *out = reinterpret_cast<drv_ipc::clk_disable_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.disable_clk(in->clk_id);
-        return out->size();
+#define HANDLER(_m_)                                                                               \
+    template<>                                                                                     \
+    mword handle<drv_ipc::_m_>([[maybe_unused]] Cpu cpu,                                           \
+                               [[maybe_unused]] drv_ipc::def<drv_ipc::_m_>::in &in,                \
+                               drv_ipc::def<drv_ipc::_m_>::out &out)
+
+HANDLER(CLK_IS_ENABLED) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::CLK_GET_RATE: {
-        drv_ipc::clk_get_rate_args *in = reinterpret_cast<drv_ipc::clk_get_rate_args *>(UTCB_BASE);
-        drv_ipc::clk_get_rate_ret *out = reinterpret_cast<drv_ipc::clk_get_rate_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.get_clkrate(in->clk_id, out->rate);
-        return out->size();
+    if (drv.is_clk_enabled(in.clk_id))
+        out.enabled = 1;
+    else
+        out.enabled = 0;
+    out.errno = ENONE;
+    return out.size();
+}
+
+HANDLER(CLK_GET_MAX) {
+    out.max_id = drv.get_max_clkid();
+    out.errno = ENONE;
+    return out.size();
+}
+
+HANDLER(CLK_ENABLE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::CLK_SET_RATE: {
-        drv_ipc::clk_set_rate_args *in = reinterpret_cast<drv_ipc::clk_set_rate_args *>(UTCB_BASE);
-        drv_ipc::clk_set_rate_ret *out = reinterpret_cast<drv_ipc::clk_set_rate_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.set_clkrate(in->clk_id, in->rate);
-        return out->size();
+    out.errno = drv.enable_clk(in.clk_id);
+    return out.size();
+}
+
+HANDLER(CLK_DISABLE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::CLK_DESCRIBE_RATE: {
-        drv_ipc::clk_describe_rate_args *in
-            = reinterpret_cast<drv_ipc::clk_describe_rate_args *>(UTCB_BASE);
-        drv_ipc::clk_describe_rate_ret *out
-            = reinterpret_cast<drv_ipc::clk_describe_rate_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.describe_clkrate(in->clk_id, out->desc);
-        return out->size();
+    out.errno = drv.disable_clk(in.clk_id);
+    drv.expire_idle();
+    return out.size();
+}
+
+HANDLER(CLK_GET_RATE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::NODE_GET_MAX: {
-        drv_ipc::clk_describe_rate_args *in
-            = reinterpret_cast<drv_ipc::clk_describe_rate_args *>(UTCB_BASE);
-        drv_ipc::clk_describe_rate_ret *out
-            = reinterpret_cast<drv_ipc::clk_describe_rate_ret *>(UTCB_BASE);
-        if (!drv.is_clk_valid(in->clk_id)) {
-            out->errno = EINVAL;
-            return out->size();
-        }
-        out->errno = drv.describe_clkrate(in->clk_id, out->desc);
-        return out->size();
+    out.errno = drv.get_clkrate(in.clk_id, out.rate);
+    return out.size();
+}
+
+HANDLER(CLK_SET_RATE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::NODE_ENABLE: {
-        drv_ipc::node_enable_args *in = reinterpret_cast<drv_ipc::node_enable_args *>(UTCB_BASE);
-        drv_ipc::node_enable_ret *out = reinterpret_cast<drv_ipc::node_enable_ret *>(UTCB_BASE);
-        out->errno = drv.enable_node(in->node_id);
-        return out->size();
+    out.errno = drv.set_clkrate(in.clk_id, in.rate);
+    return out.size();
+}
+
+HANDLER(CLK_DESCRIBE_RATE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::NODE_DISABLE: {
-        drv_ipc::node_disable_args *in = reinterpret_cast<drv_ipc::node_disable_args *>(UTCB_BASE);
-        drv_ipc::node_disable_ret *out = reinterpret_cast<drv_ipc::node_disable_ret *>(UTCB_BASE);
-        out->errno = drv.disable_node(in->node_id);
-        return out->size();
+    out.errno = drv.describe_clkrate(in.clk_id, out.desc);
+    return out.size();
+}
+
+HANDLER(CLK_ROUND_RATE) {
+    if (!drv.is_clk_valid(in.clk_id)) {
+        out.errno = EINVAL;
+        return out.size();
     }
-    case drv_ipc::method::PINCTRL_HANDLE: {
-        drv_ipc::pinctrl_args_ipc *in = reinterpret_cast<drv_ipc::pinctrl_args_ipc *>(UTCB_BASE);
-        drv_ipc::pinctrl_ret_ipc *out = reinterpret_cast<drv_ipc::pinctrl_ret_ipc *>(UTCB_BASE);
+    uint64 rate = 0;
+    out.errno = drv.round_clkrate(in.clk_id, in.rate, rate);
+    out.rate = rate;
+    return out.size();
+}
+
+HANDLER(STATUS_PAGE) {
+    uint64 pa = 0;
+    uint32 len = 0;
+    out.errno = drv.get_status_page(pa, len);
+    out.pa = pa;
+    out.len = len;
+    return out.size();
+}
+
+HANDLER(GPIO_EVT_SUBSCRIBE) {
+    uint32 client = 0;
+    uint64 ring_pa = 0;
+    Sel sm = 0;
+    out.errno = drv.gpio_evt_subscribe(cpu, in.pins, client, ring_pa, sm);
+    out.client = client;
+    out.ring_pa = ring_pa;
+    out.sm = sm;
+    return out.size();
+}
+
+HANDLER(GPIO_EVT_UNSUBSCRIBE) {
+    out.errno = drv.gpio_evt_unsubscribe(cpu, in.client);
+    return out.size();
+}
+
+HANDLER(GPIO_BANK) {
+    if (PM_GPIO_EVT_RINGS) drv.rearm_gpio_levels();
+
+    uint64 mask = 0;
+    out.errno = drv.handle_gpio_bank(in.func, in.trig, in.set, in.clr, mask);
+    out.mask = mask;
+    return out.size();
+}
+
+HANDLER(AUTOSUSPEND) {
+    uint64 delay_ns = in.delay_us * 1000;
+
+    if (in.delay_us > drv_ipc::AUTOSUSPEND_MAX_US)
+        out.errno = EINVAL;
+    else if (in.target == drv_ipc::AUTOSUSPEND_CLK)
+        out.errno = drv.set_clk_autosuspend(in.id, delay_ns);
+    else if (in.target == drv_ipc::AUTOSUSPEND_NODE)
+        out.errno = drv.set_node_autosuspend(in.id, delay_ns);
+    else
+        out.errno = EINVAL;
+    /* a shorter delay may be due already */
+    drv.expire_idle();
+    return out.size();
+}
+
+HANDLER(STATS_GET) {
+    uint32 first = in.first;
+    out.num = drv.get_stats(first, out.stats, drv_ipc::STATS_MAX);
+    out.num_stats = drv_ipc::STAT_COUNT;
+    out.tick_freq = Pm::tick_freq();
+    out.portal_cpus = drv.portal_cpus();
+    out.errno = (first < drv_ipc::STAT_COUNT) ? ENONE : EINVAL;
+    return out.size();
+}
+
+HANDLER(STATS_RESET) {
+    drv.reset_stats();
+    out.errno = ENONE;
+    return out.size();
+}
+
+HANDLER(NODE_GET_MAX) {
+    out.max_id = drv.get_max_nodeid();
+    out.errno = ENONE;
+    return out.size();
+}
+
+HANDLER(NODE_ENABLE) {
+    out.errno = drv.enable_node(in.node_id);
+    return out.size();
+}
+
+HANDLER(NODE_DISABLE) {
+    out.errno = drv.disable_node(in.node_id);
+    drv.expire_idle();
+    return out.size();
+}
 
-        out->errno = drv.handle_pinctrl(in->pins, in->num_pins, in->func);
-        mword size = (in->num_pins * sizeof(Pm::Pin)) + (sizeof(uint32) * 2);
-        return size;
+HANDLER(NODE_SET_ASYNC) {
+    uint32 token = 0;
+    bool on = in.state != 0;
+    out.errno = drv.post_node_state(cpu, in.node_id, on, token);
+    out.token = token;
+    if (!on) drv.expire_idle();
+    return out.size();
+}
+
+HANDLER(NODE_COMPLETE) {
+    out.errno = drv.complete_node_state(cpu, in.token);
+    return out.size();
+}
+
+/* bounded() in the entry already checked num_pins */
+HANDLER(PINCTRL_HANDLE) {
+    if (PM_GPIO_EVT_RINGS) drv.rearm_gpio_levels();
+
+    uint32 num_pins = in.num_pins, num_done = 0;
+
+    out.errno = drv.handle_pinctrl(in.pins, num_pins, in.func, in.flags, out.status(num_pins),
+                                   num_done);
+    out.num_done = num_done;
+    return out.size(num_pins);
+}
+
+HANDLER(CLK_BATCH) {
+    uint32 num_clks = in.num_clks, num_done = 0;
+
+    out.errno = drv.handle_clk_batch(in.clks, num_clks, num_done);
+    out.num_done = num_done;
+    drv.expire_idle();
+    return out.size(num_clks);
+}
+
+#undef HANDLER
+
+/*
+ * refuses messages that claim more than the client sent, then hands off to the handler. Clients
+ * that transfer no untyped words share the whole UTCB, those are only bounds checked.
+ */
+template<drv_ipc::method M>
+static mword
+entry(Cpu cpu, Mtd mtd) {
+    typedef drv_ipc::def<M> def;
+    typename def::in *in = reinterpret_cast<typename def::in *>(utcb_va(cpu));
+    typename def::out *out = reinterpret_cast<typename def::out *>(utcb_va(cpu));
+
+    mword sent = mtd.untyped();
+
+    if (__builtin_expect(!in->bounded() || (sent && in->size() > sent), 0)) {
+        __builtin_memset(out, 0, sizeof(*out));
+        out->errno = EINVAL;
+        return drv_ipc::words(sizeof(*out));
     }
-    default:
-        return 0;
+    return handle<M>(cpu, *in, *out);
+}
+
+static mword
+unserved(Cpu, Mtd) {
+    return 0;
+}
+
+typedef mword (*entry_fn)(Cpu, Mtd);
+
+/* dense by method id, methods without a drv_ipc::def get unserved */
+struct dispatch_table {
+    entry_fn fn[drv_ipc::METHOD_END];
+};
+
+template<uint32 M = 0>
+static constexpr void
+fill(dispatch_table &t) {
+    if constexpr (M < drv_ipc::METHOD_END) {
+        if constexpr (drv_ipc::def<drv_ipc::method(M)>::defined)
+            t.fn[M] = entry<drv_ipc::method(M)>;
+        else
+            t.fn[M] = unserved;
+        fill<M + 1>(t);
     }
+}
+
+static constexpr dispatch_table
+make_dispatch_table(void) {
+    dispatch_table t{};
+    fill(t);
+    return t;
+}
+
+static constexpr dispatch_table methods = make_dispatch_table();
+
+static mword
+serve(Cpu cpu, Mtd mtd) {
+    /* the reply overwrites the header, take the method first */
+    uint32 method = reinterpret_cast<drv_ipc::header *>(utcb_va(cpu))->id;
+    if (method >= drv_ipc::METHOD_END) return 0;
+
+    uint64 start = Pm::ticks();
+    mword words = methods.fn[method](cpu, mtd);
+    drv.record_method(cpu, method, Pm::ticks() - start);
+    return words;
+}
+
+/* one portal per CPU, each bound to the UTCB of the EC serving that CPU */
+#define RPI4_SRV_PORTAL(_cpu_)                                                                     \
+    PBL_PORTAL(rpi4_srv_##_cpu_, mword, Mtd mtd, Pbl::Utcb *) { return serve(_cpu_, mtd); }        \
+    EXPORT_PORTAL(rpi4_srv_##_cpu_, mword)
+
+RPI4_SRV_PORTAL(0);
+RPI4_SRV_PORTAL(1);
+RPI4_SRV_PORTAL(2);
+RPI4_SRV_PORTAL(3);
 
+static mword const srv_entry[] = {
+    reinterpret_cast<mword>(PT_ENTRY(rpi4_srv_0)), reinterpret_cast<mword>(PT_ENTRY(rpi4_srv_1)),
+    reinterpret_cast<mword>(PT_ENTRY(rpi4_srv_2)), reinterpret_cast<mword>(PT_ENTRY(rpi4_srv_3))};
+static_assert(sizeof(srv_entry) / sizeof(srv_entry[0]) == PM_MAX_CPUS, "one portal per CPU");
+
+/* runs once per GPIO interrupt, Pebble re-arms the interrupt when it returns */
+PBL_PORTAL(gpio_irq, mword, Mtd, Pbl::Utcb *) {
+    drv.rearm_gpio_levels();
+    drv.handle_gpio_irq();
     return 0;
 }
-EXPORT_PORTAL(rpi4_srv, mword);
+EXPORT_PORTAL(gpio_irq, mword);
+
+/* the GPIO interrupt EC comes after the service ECs, stack and UTCB alike */
+static constexpr Cpu GPIO_IRQ_SLOT = PM_MAX_CPUS;
 
 /* should match BCM2711 device tree */
 static constexpr char const *cprman_id = "/soc/cprman@7e101000";
@@ -140,19 +333,24 @@ extern "C" mword __ZIP[];
 
 /** Heap layout
  *  ---------------------
- *  |  Service stack    |  (SRV_STACK_SIZE)
+ *  |  CPU 0 stack      |  (SRV_STACK_SIZE)
+ *  +-------------------+
+ *  |  ...              |
+ *  +-------------------+
+ *  |  CPU n stack      |  (SRV_STACK_SIZE)
+ *  +-------------------+
+ *  |  GPIO IRQ stack   |  (SRV_STACK_SIZE)
  *  +-------------------+
- *  |                   |
  */
 
 static inline mword
-srv_stack_va() {
-    return Pbl::heap_start();
+srv_stack_va(Cpu cpu) {
+    return Pbl::heap_start() + cpu * SRV_STACK_SIZE;
 }
 
 static inline mword
-srv_sp_va() {
-    return srv_stack_va() + SRV_STACK_SIZE;
+srv_sp_va(Cpu cpu) {
+    return srv_stack_va(cpu) + SRV_STACK_SIZE;
 }
 
 /* 0x1f = all permissions */
@@ -168,18 +366,60 @@ pbl_main(Pbl::Utcb *utcb, Cpu cpu) {
     Errno err = drv.probe(utcb, cprman_id, aux_id, mbox_id, gpio_id);
     ASSERT(err == Errno::ENONE);
 
-    Sel ec_sel(SELS_BASE++);
-    Sel evt_base(0);
-    err = Pbl::create_local_ec(utcb, ec_sel, cpu, UTCB_BASE, srv_sp_va(), evt_base);
-    ASSERT(err == Errno::ENONE);
-
     /*Get our UUID from the ZIP*/
     Uuid *my_uuid = reinterpret_cast<Uuid *>(__ZIP);
 
+    Sel boot_ec(SELS_BASE++);
+    Sel evt_base(0);
+    err = Pbl::create_local_ec(utcb, boot_ec, cpu, utcb_va(cpu), srv_sp_va(cpu), evt_base);
+    ASSERT(err == Errno::ENONE);
+
     /* allow PM connection */
     Sel pt_sel(SELS_BASE++);
-    err = Pbl::API::srv_create(utcb, ec_sel, *my_uuid, NOVA_PT_CRD(pt_sel), 0,
-                               reinterpret_cast<mword>(PT_ENTRY(rpi4_srv)));
+    err = Pbl::API::srv_create(utcb, boot_ec, *my_uuid, NOVA_PT_CRD(pt_sel), 0, srv_entry[cpu]);
+    if (err != Errno::ENONE) return;
+
+    /*
+     * Every CPU also gets a portal named by drv_ipc::cpu_uuid(), on an EC of
+     * its own for the other CPUs, so a client can be served on its own core.
+     * CPUs that fail are left out of the portal_cpus STATS_GET reports, their
+     * clients stay on the boot CPU's portal.
+     */
+    for (Cpu c = 0; c < PM_MAX_CPUS; c++) {
+        Sel ec_sel(boot_ec);
+        if (c != cpu) {
+            ec_sel = SELS_BASE++;
+            err = Pbl::create_local_ec(utcb, ec_sel, c, utcb_va(c), srv_sp_va(c), evt_base);
+            if (err != Errno::ENONE) continue;
+        }
+
+        pt_sel = SELS_BASE++;
+        err = Pbl::API::srv_create(utcb, ec_sel, drv_ipc::cpu_uuid(*my_uuid, c),
+                                   NOVA_PT_CRD(pt_sel), 0, srv_entry[c]);
+        if (err == Errno::ENONE) drv.add_portal(c);
+    }
+
+    /*
+     * GPIO events are optional, without them clients poll PM_GET_GPIOEVT.
+     * Only builds with PM_GPIO_EVT_RINGS take the interrupt at all, its
+     * handler acks the events the pollers would otherwise see.
+     */
+    if (PM_GPIO_EVT_RINGS) {
+        Sel irq_sel(SELS_BASE++);
+        err = Pbl::API::acquire_resource(utcb, gpio_id, Pbl::API::RES_IRQ, GPIO_IRQ_ALL_BANKS,
+                                         irq_sel, 0, true);
+        if (err == Errno::ENONE) {
+            Sel ec_sel(SELS_BASE++);
+            err = Pbl::API::irq_attach(utcb, irq_sel, ec_sel, cpu, utcb_va(GPIO_IRQ_SLOT),
+                                       srv_sp_va(GPIO_IRQ_SLOT),
+                                       reinterpret_cast<mword>(PT_ENTRY(gpio_irq)));
+        }
+        if (err == Errno::ENONE) {
+            Sel sm_base(SELS_BASE);
+            SELS_BASE += drv_ipc::GPIO_EVT_CLIENTS;
+            drv.gpio_evt_init(utcb, sm_base);
+        }
+    }
 
-    if (err == Errno::ENONE) drv.success();
+    drv.success();
 }
@@ -48,22 +48,284 @@ Rpi4::probe(Pbl::Utcb *utcb, const char *cprman_id, const char *aux_id, const ch
 
     _fw.set_gpio(130, 1); /* Firmware power LED off, checkpoint*/
 
+    /* one cached page the clients map read-only */
+    if (PM_STATUS_PAGE) {
+        mword status_va(STATUS_BASE);
+        err = Pbl::API::dma_mmap(utcb, status_va, PAGE_SIZE, 0xd, true, _status_pa);
+        if (err != Errno::ENONE) return err;
+
+        _status = reinterpret_cast<drv_ipc::status_page *>(status_va);
+        memset(_status, 0, sizeof(*_status));
+        _status->magic = drv_ipc::status_page::MAGIC;
+        _status->num_clks = BCM2711_CLOCK_TOTAL;
+        _status->num_nodes = drv_ipc::NODE_DEVICE_END;
+        _status->num_gpios = NUM_GPIO;
+    }
+
+    for (auto &p : _posted)
+        p.used = false;
+    for (auto &cpu : _method_stats)
+        for (auto &s : cpu)
+            s.reset();
+
+    /*
+     * All domains in one message. Firmware that does not know every domain
+     * fails the batch, ask those one by one; a domain nobody can tell us
+     * about is taken as off and powered on by its first enable.
+     */
+    uint32 pds[RPI_POWER_DOMAIN_COUNT], state[RPI_POWER_DOMAIN_COUNT];
+    for (uint32 i = 0; i < RPI_POWER_DOMAIN_COUNT; i++)
+        pds[i] = i;
+    if (_fw.get_power_domains(pds, RPI_POWER_DOMAIN_COUNT, state) != Errno::ENONE) {
+        for (uint32 i = 0; i < RPI_POWER_DOMAIN_COUNT; i++)
+            if (_fw.get_power_domain(i, state[i]) != Errno::ENONE) state[i] = 0;
+    }
+    _idle_pds = 0;
+    for (uint32 i = 0; i < RPI_POWER_DOMAIN_COUNT; i++) {
+        _pd[i].refs = 0;
+        _pd[i].on = (state[i] & 1) != 0;
+        _pd[i].pending = false;
+        _pd[i].idle_delay = 0;
+        _pd[i].idle_at = 0;
+    }
+
+    if (PM_STATUS_PAGE) {
+        for (uint32 i = 0; i < RPI_POWER_DOMAIN_COUNT; i++)
+            _status->node_state[i] = _pd[i].on ? 1 : 0;
+        for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++) {
+            clk_state st = _clock_manager.state(i);
+            _status->clks[i] = {st.rate, st.parent, st.enabled};
+        }
+        _clock_manager.take_published();
+        publish_gpios();
+    }
+
     return err;
 }
 
+static_assert(BCM2711_CLOCK_TOTAL <= drv_ipc::status_page::MAX_CLKS, "status page too small");
+static_assert(RPI_POWER_DOMAIN_COUNT <= drv_ipc::DEVICE_NODE_BASE, "device nodes overlap domains");
+static_assert(drv_ipc::NODE_DEVICE_END <= drv_ipc::status_page::MAX_NODES, "status page too small");
+static_assert(rpi_pinctrl::NUM_BANKS == drv_ipc::status_page::GPIO_BANKS, "GPIO layout mismatch");
+static_assert(rpi_pinctrl::NUM_FSEL_REGS == drv_ipc::status_page::GPIO_FSEL_REGS,
+              "GPIO layout mismatch");
+
+void
+Rpi4::status_begin(void) {
+    _status_lock.lock();
+    __atomic_store_n(&_status->seq, _status->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+Rpi4::status_end(void) {
+    __atomic_store_n(&_status->seq, _status->seq + 1, __ATOMIC_RELEASE);
+    _status_lock.unlock();
+}
+
+/* only the clocks cprman republished since the last call */
+void
+Rpi4::publish_clocks(void) {
+    if (!PM_STATUS_PAGE) return;
+
+    uint64 changed = _clock_manager.take_published();
+    if (!changed) return;
+
+    status_begin();
+    for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++) {
+        if (!(changed & (1ull << i))) continue;
+        clk_state st = _clock_manager.state(i);
+        _status->clks[i] = {st.rate, st.parent, st.enabled};
+    }
+    status_end();
+}
+
+void
+Rpi4::publish_gpios(void) {
+    if (!PM_STATUS_PAGE) return;
+
+    rpi_pinctrl::bank_state banks[rpi_pinctrl::NUM_BANKS];
+    for (uint32 b = 0; b < rpi_pinctrl::NUM_BANKS; b++)
+        banks[b] = _pinctrl.state(b);
+
+    /* GPFSEL3 is shared, each bank knows the function of its own pins */
+    status_begin();
+    for (uint32 r = 0; r < rpi_pinctrl::NUM_FSEL_REGS; r++)
+        _status->gpio_fsel[r] = banks[(r * 10) / 32].fsel[r];
+    for (uint32 b = 0; b < rpi_pinctrl::NUM_BANKS; b++)
+        _status->gpio_level[b] = banks[b].level;
+    status_end();
+}
+
+void
+Rpi4::publish_node(uint32 node_id, uint32 state) {
+    if (!PM_STATUS_PAGE) return;
+
+    status_begin();
+    _status->node_state[node_id] = static_cast<uint8>(state);
+    status_end();
+}
+
+Errno
+Rpi4::get_status_page(uint64 &pa, uint32 &len) {
+    if (!PM_STATUS_PAGE) return Errno::ENOTSUP;
+    if (!_status) return Errno::ENOENT;
+    pa = _status_pa;
+    len = PAGE_SIZE;
+    return Errno::ENONE;
+}
+
+Errno
+Rpi4::gpio_evt_init(Pbl::Utcb *utcb, Sel sm_base) {
+    /* one cached page per subscriber, shared with that client only */
+    mword evt_va(EVT_BASE), evt_pa;
+    Errno err = Pbl::API::dma_mmap(utcb, evt_va, EVT_SIZE, 0xd, true, evt_pa);
+    if (err != Errno::ENONE) return err;
+
+    for (uint32 c = 0; c < drv_ipc::GPIO_EVT_CLIENTS; c++) {
+        err = Pbl::API::sm_create(utcb, sm_base + c, 0);
+        if (err != Errno::ENONE) return err;
+        _evt_client[c] = {0, 0, sm_base + c, 0, false};
+    }
+
+    memset(reinterpret_cast<void *>(evt_va), 0, EVT_SIZE);
+    _evt_pins = 0;
+    _evt_masked = 0;
+    _evt_pa = evt_pa;
+    _evt_ring = reinterpret_cast<drv_ipc::gpio_evt_ring *>(evt_va);
+    return Errno::ENONE;
+}
+
+Errno
+Rpi4::gpio_evt_subscribe(Cpu cpu, uint64 pins, uint32 &client, uint64 &ring_pa, Sel &sm) {
+    if (!_evt_ring) return Errno::ENOTSUP;
+    if (!pins || (pins >> NUM_GPIO)) return Errno::EINVAL;
+
+    Pm::Lock_guard guard(_evt_lock);
+    if (pins & _evt_pins) return Errno::EBUSY;
+    for (uint32 c = 0; c < drv_ipc::GPIO_EVT_CLIENTS; c++) {
+        if (_evt_client[c].used) continue;
+
+        drv_ipc::gpio_evt_ring &ring = _evt_ring[c];
+        ring.head = ring.tail = ring.dropped = 0;
+        _evt_client[c].pins = pins;
+        _evt_client[c].cpu = cpu;
+        _evt_client[c].used = true;
+        _evt_pins |= pins;
+
+        client = c;
+        ring_pa = _evt_pa + c * PAGE_SIZE;
+        sm = _evt_client[c].sm;
+        return Errno::ENONE;
+    }
+    return Errno::EBUSY;
+}
+
+Errno
+Rpi4::gpio_evt_unsubscribe(Cpu cpu, uint32 client) {
+    if (!_evt_ring) return Errno::ENOTSUP;
+    if (client >= drv_ipc::GPIO_EVT_CLIENTS) return Errno::EINVAL;
+
+    Pm::Lock_guard guard(_evt_lock);
+    if (!_evt_client[client].used) return Errno::ENOENT;
+    if (_evt_client[client].cpu != cpu) return Errno::EPERM;
+    _pinctrl.unmask_levels(_evt_client[client].masked);
+    _evt_client[client].used = false;
+    _evt_client[client].pins = 0;
+    _evt_client[client].masked = 0;
+
+    _evt_pins = 0;
+    for (auto &c : _evt_client)
+        _evt_pins |= c.pins;
+    return Errno::ENONE;
+}
+
+/* the client owns tail, a full ring drops the event instead of blocking the interrupt */
+static bool
+push_evt(drv_ipc::gpio_evt_ring &ring, const drv_ipc::gpio_evt &evt) {
+    uint32 head = ring.head;
+    if (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) >= drv_ipc::gpio_evt_ring::SIZE) {
+        __atomic_store_n(&ring.dropped, ring.dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    ring.evts[head % drv_ipc::gpio_evt_ring::SIZE] = evt;
+    __atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void
+Rpi4::handle_gpio_irq(void) {
+    uint64 ts = Pm::ticks();
+    uint32 wake = 0;
+
+    for (uint32 b = 0; b < rpi_pinctrl::NUM_BANKS; b++) {
+        uint32 level = 0;
+        uint32 evts = _pinctrl.take_events(b, level);
+        if (!evts) continue;
+
+        Pm::Lock_guard guard(_evt_lock);
+        uint32 wanted = static_cast<uint32>(_evt_pins >> (b * 32));
+        /* level triggers stay masked until PM_CLR_GPIOEVT or rearm_gpio_levels() */
+        _pinctrl.latch_events(b, evts & ~wanted);
+
+        for (evts &= wanted; evts; evts &= evts - 1) {
+            uint32 pin = b * 32 + static_cast<uint32>(__builtin_ctz(evts));
+            drv_ipc::gpio_evt evt = {ts, pin, _pinctrl.event_trigger(pin, level)};
+
+            for (uint32 c = 0; c < drv_ipc::GPIO_EVT_CLIENTS; c++) {
+                if (!(_evt_client[c].pins & (1ull << pin))) continue;
+                /* a dropped event is raised again once the ring has room */
+                if (push_evt(_evt_ring[c], evt)) wake |= 1u << c;
+                _evt_client[c].masked |= 1ull << pin;
+                __atomic_fetch_or(&_evt_masked, 1ull << pin, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    /* one signal per client and interrupt, however many events it got */
+    for (uint32 c = 0; wake; c++, wake >>= 1)
+        if (wake & 1) Pbl::API::sm_up(_evt_client[c].sm);
+}
+
+void
+Rpi4::rearm_gpio_levels(void) {
+    if (!__atomic_load_n(&_evt_masked, __ATOMIC_RELAXED)) return;
+
+    Pm::Lock_guard guard(_evt_lock);
+    uint64 masked = 0;
+    for (uint32 c = 0; c < drv_ipc::GPIO_EVT_CLIENTS; c++) {
+        gpio_evt_client &client = _evt_client[c];
+        if (!client.masked) continue;
+
+        /* every event queued so far, and with it the masked pins, has been handled */
+        drv_ipc::gpio_evt_ring &ring = _evt_ring[c];
+        if (__atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) == ring.head) {
+            _pinctrl.unmask_levels(client.masked);
+            client.masked = 0;
+        }
+        masked |= client.masked;
+    }
+    __atomic_store_n(&_evt_masked, masked, __ATOMIC_RELAXED);
+}
+
 Errno
 Rpi4::enable_clk(uint64 clk_id) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (!clk) return Errno::EINVAL;
-    if (clk->is_prepared()) return Errno::ENONE;
-    return clk->prepare();
+    Errno err;
+    {
+        clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), false);
+        err = _clock_manager.enable(static_cast<uint8>(clk_id));
+    }
+    publish_clocks();
+    return err;
 }
 
 Errno
 Rpi4::get_clkrate(uint64 clk_id, uint64 &value) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (!clk) return Errno::EINVAL;
-    value = clk->get_rate();
+    value = _clock_manager.state(static_cast<uint8>(clk_id)).rate;
     return Errno::ENONE;
 }
 
@@ -71,14 +333,27 @@ Errno
 Rpi4::disable_clk(uint64 clk_id) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (!clk) return Errno::EINVAL;
-    return clk->unprepare();
+    Errno err;
+    {
+        clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), false);
+        err = _clock_manager.disable(static_cast<uint8>(clk_id));
+    }
+    publish_clocks();
+    return err;
 }
 
 Errno
 Rpi4::set_clkrate(uint64 clk_id, uint64 value) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (!clk) return Errno::EINVAL;
-    return clk->set_rate(value);
+    /* the plan may move the clock to a parent in another PLL subtree */
+    Errno err;
+    {
+        clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), true);
+        err = _clock_manager.set_rate(static_cast<uint8>(clk_id), value);
+    }
+    publish_clocks();
+    return err;
 }
 
 uint32
@@ -90,11 +365,13 @@ bool
 Rpi4::is_clk_enabled(uint64 clk_id) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (!clk) return false;
-    return clk->is_prepared();
+    return _clock_manager.state(static_cast<uint8>(clk_id)).enabled;
 }
 
 bool
 Rpi4::is_clk_valid(uint64 clk_id) {
+    /* the clock manager takes 8-bit ids, do not let larger ones alias */
+    if (clk_id >= BCM2711_CLOCK_TOTAL) return false;
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
     if (clk)
         return true;
@@ -105,81 +382,703 @@ Rpi4::is_clk_valid(uint64 clk_id) {
 Errno
 Rpi4::describe_clkrate(uint64 clk_id, Pm::clk_desc &rate) {
     rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
-    if (!clk)
-        return Errno::EINVAL;
-    else
-        return clk->describe_rate(rate);
+    if (!clk) return Errno::EINVAL;
+    clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), true);
+    return _clock_manager.describe_rate(static_cast<uint8>(clk_id), rate);
+}
+
+Errno
+Rpi4::round_clkrate(uint64 clk_id, uint64 rate, uint64 &rounded) {
+    rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
+    if (!clk) return Errno::EINVAL;
+    clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), true);
+    return _clock_manager.round_rate(static_cast<uint8>(clk_id), rate, rounded);
+}
+
+void
+Rpi4::record_method(Cpu cpu, uint32 method, uint64 ticks) {
+    if (cpu < PM_MAX_CPUS && method < drv_ipc::METHOD_END)
+        _method_stats[cpu][method].record_local(ticks);
+}
+
+static_assert(drv_ipc::STAT_CLK_PREPARE + cprman::CLK_STAT_COUNT == drv_ipc::STAT_FW_MSG,
+              "clock statistics out of line");
+static_assert(drv_ipc::STAT_FW_MSG + rpi_fw::FW_STAT_COUNT == drv_ipc::STAT_COUNT,
+              "mailbox statistics out of line");
+
+uint32
+Rpi4::get_stats(uint32 first, Pm::Stat *stats, uint32 max) {
+    uint32 num = 0;
+
+    for (uint32 id = first; id < drv_ipc::STAT_COUNT && num < max; id++, num++) {
+        if (id >= drv_ipc::STAT_FW_MSG) {
+            _fw.stat(id - drv_ipc::STAT_FW_MSG).read(stats[num]);
+        } else if (id >= drv_ipc::STAT_CLK_PREPARE) {
+            _clock_manager.stat(id - drv_ipc::STAT_CLK_PREPARE).read(stats[num]);
+        } else {
+            /* the portal statistics are kept per CPU */
+            Pm::Stat cpu_stat;
+            stats[num] = {};
+            for (auto &cpu : _method_stats) {
+                cpu[id].read(cpu_stat);
+                stats[num].merge(cpu_stat);
+            }
+        }
+    }
+    return num;
+}
+
+void
+Rpi4::reset_stats(void) {
+    for (auto &cpu : _method_stats)
+        for (auto &s : cpu)
+            s.reset();
+    _clock_manager.reset_stats();
+    _fw.reset_stats();
 }
 
 void
 Rpi4::success() {
     /*Green LED ON*/
     _pinctrl.set_gpio(42, 1);
+    publish_gpios();
 }
 
 /* The undocumented firmware GPIO interface is not exposed to clients.
     currently, only the RED LED is known to be under firmware control */
 Errno
-Rpi4::handle_pinctrl(Pm::Pin *pins, uint32 num_pins, uint32 func) {
-    Errno err = Errno::EINVAL;
+Rpi4::handle_pinctrl(Pm::Pin *pins, uint32 num_pins, uint32 func, uint32 flags, uint32 *status,
+                     uint32 &num_done) {
+    Errno ret = Errno::ENONE;
+    bool stop_on_error = (flags & drv_ipc::PINCTRL_STOP_ON_ERROR) != 0;
 
-    for (uint8 i = 0; i < num_pins; i++) {
+    if (!num_pins) {
+        num_done = 0;
+        return Errno::EINVAL;
+    }
+
+    /* register writes are coalesced per bank for the setters */
+    switch (func) {
+    case PM_SET_PINFUNC:
+        ret = _pinctrl.set_pin_function_bulk(pins, num_pins, status, stop_on_error, num_done);
+        publish_gpios();
+        return ret;
+    case PM_SET_PINPAD:
+        return _pinctrl.set_pin_pad_bulk(pins, num_pins, status, stop_on_error, num_done);
+    case PM_SET_GPIO:
+        ret = _pinctrl.set_gpio_bulk(pins, num_pins, status, stop_on_error, num_done);
+        publish_gpios();
+        return ret;
+    default:
+        break;
+    }
+
+    for (num_done = 0; num_done < num_pins;) {
+        Pm::Pin &pin = pins[num_done];
+        Errno err;
 
         switch (func) {
-        case PM_SET_PINFUNC:
-            err = _pinctrl.set_pin_function(pins[i].id, pins[i].val);
-            break;
         case PM_GET_PINFUNC:
-            err = _pinctrl.get_pin_function(pins[i].id, pins[i].val);
-            break;
-        case PM_SET_PINPAD:
-            err = _pinctrl.set_pin_pad(pins[i].id, pins[i].val);
+            err = _pinctrl.get_pin_function(pin.id, pin.val);
             break;
         case PM_GET_PINPAD:
-            err = _pinctrl.get_pin_pad(pins[i].id, pins[i].val);
-            break;
-        case PM_SET_GPIO:
-            err = _pinctrl.set_gpio(pins[i].id, pins[i].val);
+            err = _pinctrl.get_pin_pad(pin.id, pin.val);
             break;
         case PM_GET_GPIO:
-            err = _pinctrl.get_gpio(pins[i].id, pins[i].val);
+            err = _pinctrl.get_gpio(pin.id, pin.val);
             break;
         case PM_GET_GPIOTRIG:
-            err = _pinctrl.get_gpio_trigger(pins[i].id, pins[i].val);
+            err = _pinctrl.get_gpio_trigger(pin.id, pin.val);
             break;
         case PM_SET_GPIOTRIG:
-            err = _pinctrl.set_gpio_trigger(pins[i].id, pins[i].val);
+            err = _pinctrl.set_gpio_trigger(pin.id, pin.val);
             break;
         case PM_GET_GPIOEVT:
-            err = _pinctrl.get_gpio_event(pins[i].id, pins[i].val);
+            err = _pinctrl.get_gpio_event(pin.id, pin.val);
             break;
         case PM_CLR_GPIOEVT:
-            err = _pinctrl.clr_gpio_event(pins[i].id);
+            err = _pinctrl.clr_gpio_event(pin.id);
             break;
 
         default:
             err = Errno::ENOTSUP;
             break;
         }
+
+        status[num_done++] = static_cast<uint32>(err);
+        if (err == Errno::ENONE) continue;
+
+        if (ret == Errno::ENONE) ret = err;
+        if (stop_on_error) break;
+    }
+
+    return ret;
+}
+
+Errno
+Rpi4::handle_gpio_bank(uint32 func, uint32 trig, uint64 set, uint64 clr, uint64 &mask) {
+    Errno err;
+
+    mask = 0;
+    switch (func) {
+    case PM_GET_GPIOBANK:
+        return _pinctrl.get_gpio_mask(mask);
+    case PM_SET_GPIOBANK:
+        err = _pinctrl.set_gpio_mask(set, clr);
+        if (err == Errno::ENONE) publish_gpios();
+        return err;
+    case PM_GET_GPIOEVTBANK:
+        return _pinctrl.get_gpio_event_mask(mask);
+    case PM_CLR_GPIOEVTBANK:
+        return _pinctrl.clr_gpio_event_mask(set);
+    case PM_GET_GPIOTRIGBANK:
+        return _pinctrl.get_gpio_trigger_mask(trig, mask);
+    default:
+        return Errno::ENOTSUP;
     }
+}
+
+Errno
+Rpi4::handle_clk_batch(drv_ipc::clk_batch_entry *clks, uint32 num_clks, uint32 &num_done) {
+    Errno err = Errno::ENONE;
+
+    for (num_done = 0; num_done < num_clks; num_done++) {
+        drv_ipc::clk_batch_entry &e = clks[num_done];
+
+        if (!is_clk_valid(e.clk_id)) {
+            err = Errno::EINVAL;
+        } else {
+            switch (e.op) {
+            case drv_ipc::CLK_OP_ENABLE:
+                err = enable_clk(e.clk_id);
+                break;
+            case drv_ipc::CLK_OP_DISABLE:
+                err = disable_clk(e.clk_id);
+                break;
+            case drv_ipc::CLK_OP_IS_ENABLED:
+                err = Errno::ENONE;
+                break;
+            case drv_ipc::CLK_OP_GET_RATE:
+                err = Errno::ENONE;
+                break;
+            case drv_ipc::CLK_OP_SET_RATE:
+                err = set_clkrate(e.clk_id, e.rate);
+                break;
+            default:
+                err = Errno::ENOTSUP;
+                break;
+            }
+        }
+
+        e.err = static_cast<uint32>(err);
+        if (err != Errno::ENONE) break;
+
+        /* rates are memoized, reporting them costs no device access */
+        if (e.op == drv_ipc::CLK_OP_IS_ENABLED)
+            e.rate = is_clk_enabled(e.clk_id) ? 1 : 0;
+        else
+            get_clkrate(e.clk_id, e.rate);
+    }
+
     return err;
 }
 
 uint32
 Rpi4::get_max_nodeid(void) {
-    return RPI_POWER_DOMAIN_COUNT;
+    return drv_ipc::NODE_DEVICE_END;
+}
+
+bool
+Rpi4::pd_request(uint32 id, bool on) {
+    power_domain &pd = _pd[id];
+
+    if (on) {
+        /* back within the idle window, the domain never went off */
+        pd.idle_at = 0;
+        return (pd.refs++ == 0) && !pd.on;
+    }
+
+    /* a disable nobody enabled before still powers the domain off, right away */
+    if (!pd.refs) {
+        pd.idle_at = 0;
+        return pd.on;
+    }
+    if (--pd.refs || !pd.on) return false;
+    if (!pd.idle_delay) return true;
+
+    pd.idle_at = Pm::Idle_timer::deadline(pd.idle_delay);
+    __atomic_fetch_or(&_idle_pds, 1u << id, __ATOMIC_SEQ_CST);
+    _pd_idle.arm(pd.idle_at);
+    return false;
 }
 
 Errno
-Rpi4::enable_node(uint64 node_id) {
-    if (node_id > RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
+Rpi4::request_domains(uint32 pds, bool on) {
+    uint32 ids[RPI_POWER_DOMAIN_COUNT], refs[RPI_POWER_DOMAIN_COUNT], num = 0;
+    uint64 idle_at[RPI_POWER_DOMAIN_COUNT];
+    Errno err = Errno::ENONE;
+
+    if (pds >> RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
 
-    return _fw.set_power_domain(static_cast<uint32>(node_id), 1);
+    /* ascending, like every other caller that takes more than one */
+    for (uint32 m = pds; m; m &= m - 1)
+        _pd[__builtin_ctz(m)].lock.lock();
+
+    for (uint32 m = pds; m && err == Errno::ENONE; m &= m - 1)
+        if (_pd[__builtin_ctz(m)].pending) err = Errno::EBUSY;
+
+    for (uint32 m = pds; m && err == Errno::ENONE; m &= m - 1) {
+        uint32 i = static_cast<uint32>(__builtin_ctz(m));
+        refs[i] = _pd[i].refs;
+        idle_at[i] = _pd[i].idle_at;
+        if (pd_request(i, on)) ids[num++] = i;
+    }
+
+    if (err == Errno::ENONE && num) {
+        if (num == 1)
+            err = _fw.set_power_domain(ids[0], on ? 1 : 0);
+        else
+            err = _fw.set_power_domains(ids, num, on ? 1 : 0);
+
+        for (uint32 m = pds; m && err != Errno::ENONE; m &= m - 1) {
+            uint32 i = static_cast<uint32>(__builtin_ctz(m));
+            _pd[i].refs = refs[i];
+            _pd[i].idle_at = idle_at[i];
+        }
+        for (uint32 k = 0; err == Errno::ENONE && k < num; k++) {
+            _pd[ids[k]].on = on;
+            publish_node(ids[k], on ? 1 : 0);
+        }
+    }
+
+    for (uint32 m = pds; m; m &= ~(1u << (31 - __builtin_clz(m))))
+        _pd[31 - __builtin_clz(m)].lock.unlock();
+    return err;
+}
+
+void
+Rpi4::expire_domains(uint64 now) {
+    if (!_pd_idle.take(now)) return;
+
+    uint32 pds = __atomic_load_n(&_idle_pds, __ATOMIC_SEQ_CST);
+    uint32 ids[RPI_POWER_DOMAIN_COUNT], num = 0;
+
+    for (uint32 m = pds; m; m &= m - 1)
+        _pd[__builtin_ctz(m)].lock.lock();
+
+    for (uint32 m = pds; m; m &= m - 1) {
+        uint32 i = static_cast<uint32>(__builtin_ctz(m));
+        power_domain &pd = _pd[i];
+
+        if (pd.idle_at > now) {
+            _pd_idle.arm(pd.idle_at);
+            continue;
+        }
+        __atomic_fetch_and(&_idle_pds, ~(1u << i), __ATOMIC_SEQ_CST);
+        if (pd.idle_at && !pd.refs && pd.on && !pd.pending) ids[num++] = i;
+        pd.idle_at = 0;
+    }
+
+    /* a domain the firmware fails to power off stays on, like a failed disable */
+    Errno err = Errno::ENONE;
+    if (num == 1)
+        err = _fw.set_power_domain(ids[0], 0);
+    else if (num)
+        err = _fw.set_power_domains(ids, num, 0);
+    for (uint32 k = 0; err == Errno::ENONE && k < num; k++) {
+        _pd[ids[k]].on = false;
+        publish_node(ids[k], 0);
+    }
+
+    for (uint32 m = pds; m; m &= ~(1u << (31 - __builtin_clz(m))))
+        _pd[31 - __builtin_clz(m)].lock.unlock();
+}
+
+void
+Rpi4::expire_idle(void) {
+    bool clks = _clock_manager.idle_armed();
+    if (!clks && !_pd_idle.armed() && !_posted_reap.armed()) return;
+
+    uint64 now = Pm::ticks();
+    if (clks) {
+        _clock_manager.expire_idle(now);
+        publish_clocks();
+    }
+    reap_posted(now);
+    expire_domains(now);
+}
+
+void
+Rpi4::set_pd_autosuspend(uint32 id, uint64 delay) {
+    power_domain &pd = _pd[id];
+    Pm::Lock_guard guard(pd.lock);
+    pd.idle_delay = delay;
+
+    /* a running timer expires by the new delay at the latest */
+    uint64 at = Pm::Idle_timer::deadline(delay);
+    if (pd.idle_at > at) {
+        pd.idle_at = at;
+        _pd_idle.arm(pd.idle_at);
+    }
+}
+
+/* a leaf clock of a device node, cprman powers its parents; rate 0 keeps the rate */
+struct device_clk {
+    uint8 id;
+    uint64 rate;
+};
+
+struct device_pin {
+    uint8 pin;
+    uint8 func;
+    uint8 pad;
+};
+
+/**
+ * What a device node brings up, in this order: its power domains (a mask of
+ * RPI_POWER_DOMAIN_*), its clocks, its pins. Disabling goes the other way
+ * and returns the pins to GPIO inputs.
+ */
+static constexpr uint32 DEVICE_MAX_PINS = 6;
+
+struct device_desc {
+    uint32 pds;
+    device_clk clks[DEVICE_MAX_CLKS];
+    uint32 num_clks;
+    device_pin pins[DEVICE_MAX_PINS];
+    uint32 num_pins;
+};
+
+static constexpr uint8 FSEL_GPIO_IN = 0;
+static constexpr uint8 FSEL_ALT3 = 7;
+
+static constexpr device_desc device_nodes[] = {
+    /* NODE_V3D */
+    {1u << RPI_POWER_DOMAIN_V3D, {{BCM2835_CLOCK_V3D, 500000000ull}}, 1, {}, 0},
+    /* NODE_H264 */
+    {1u << RPI_POWER_DOMAIN_H264, {{BCM2835_CLOCK_H264, 0}}, 1, {}, 0},
+    /* NODE_ISP, fed by the camera port */
+    {(1u << RPI_POWER_DOMAIN_ISP) | (1u << RPI_POWER_DOMAIN_UNICAM1),
+     {{BCM2835_CLOCK_ISP, 0}},
+     1,
+     {},
+     0},
+    /* NODE_EMMC, the Arasan controller wired to the WiFi chip over SDIO */
+    {0,
+     {{BCM2835_CLOCK_EMMC, 0}},
+     1,
+     {{34, FSEL_ALT3, Pm::PAD_NONE},
+      {35, FSEL_ALT3, Pm::PULLUP},
+      {36, FSEL_ALT3, Pm::PULLUP},
+      {37, FSEL_ALT3, Pm::PULLUP},
+      {38, FSEL_ALT3, Pm::PULLUP},
+      {39, FSEL_ALT3, Pm::PULLUP}},
+     6},
+    /* NODE_EMMC2, the SD card slot; its pads do not go through the GPIO block */
+    {0, {{BCM2711_CLOCK_EMMC2, 100000000ull}}, 1, {}, 0},
+};
+
+static_assert(sizeof(device_nodes) / sizeof(device_nodes[0]) == NUM_DEVICE_NODES,
+              "one description per device node");
+
+Errno
+Rpi4::set_device_pins(uint32 dev, bool on) {
+    const device_desc &desc = device_nodes[dev];
+    Pm::Pin funcs[DEVICE_MAX_PINS], pads[DEVICE_MAX_PINS];
+    uint32 status[DEVICE_MAX_PINS], num_done;
+
+    for (uint32 i = 0; i < desc.num_pins; i++) {
+        funcs[i] = {desc.pins[i].pin, on ? desc.pins[i].func : FSEL_GPIO_IN};
+        pads[i] = {desc.pins[i].pin, desc.pins[i].pad};
+    }
+
+    /* pulls first, the pads must not float once the function drives them */
+    Errno err = Errno::ENONE;
+    if (on) err = _pinctrl.set_pin_pad_bulk(pads, desc.num_pins, status, true, num_done);
+    if (err == Errno::ENONE)
+        err = _pinctrl.set_pin_function_bulk(funcs, desc.num_pins, status, true, num_done);
+    publish_gpios();
+    return err;
+}
+
+Errno
+Rpi4::enable_device_clk(uint8 clk_id, uint64 rate, uint64 &saved_rate) {
+    saved_rate = 0;
+    if (!rate) return enable_clk(clk_id);
+
+    Errno err;
+    {
+        /* one hold of the lock, so no other consumer comes in between */
+        clk_guard guard(_clock_manager, clk_id, true);
+        uint64 cur = _clock_manager.state(clk_id).rate, planned = 0;
+        err = _clock_manager.planned_rate(clk_id, rate, planned);
+        if (err == Errno::ENONE && cur != planned) {
+            if (_clock_manager.users(clk_id))
+                err = Errno::EBUSY;
+            else
+                err = _clock_manager.set_rate(clk_id, rate);
+            if (err == Errno::ENONE) saved_rate = cur;
+        }
+        if (err == Errno::ENONE) err = _clock_manager.enable(clk_id);
+        if (err != Errno::ENONE && saved_rate) {
+            _clock_manager.set_rate(clk_id, saved_rate);
+            saved_rate = 0;
+        }
+    }
+    publish_clocks();
+    return err;
+}
+
+/* the node's rate stays only if another consumer runs at it by now */
+Errno
+Rpi4::disable_device_clk(uint8 clk_id, uint64 saved_rate) {
+    if (!saved_rate) return disable_clk(clk_id);
+
+    Errno err;
+    {
+        clk_guard guard(_clock_manager, clk_id, true);
+        err = _clock_manager.disable(clk_id);
+        if (err == Errno::ENONE && !_clock_manager.users(clk_id))
+            err = _clock_manager.set_rate(clk_id, saved_rate);
+    }
+    publish_clocks();
+    return err;
+}
+
+Errno
+Rpi4::enable_device(uint32 dev) {
+    const device_desc &desc = device_nodes[dev];
+    device_state &st = _dev[dev];
+    Pm::Lock_guard guard(st.lock);
+
+    if (st.refs) {
+        st.refs++;
+        return Errno::ENONE;
+    }
+
+    Errno err = request_domains(desc.pds, true);
+    if (err != Errno::ENONE) return err;
+
+    uint32 n;
+    for (n = 0; n < desc.num_clks; n++) {
+        err = enable_device_clk(desc.clks[n].id, desc.clks[n].rate, st.saved_rate[n]);
+        if (err != Errno::ENONE) break;
+    }
+    if (err == Errno::ENONE && desc.num_pins) err = set_device_pins(dev, true);
+
+    if (err != Errno::ENONE) {
+        while (n-- > 0)
+            disable_device_clk(desc.clks[n].id, st.saved_rate[n]);
+        request_domains(desc.pds, false);
+        return err;
+    }
+
+    st.refs = 1;
+    publish_node(drv_ipc::DEVICE_NODE_BASE + dev, 1);
+    return err;
+}
+
+/* teardown goes on past a failing step, the first error is reported */
+Errno
+Rpi4::disable_device(uint32 dev) {
+    const device_desc &desc = device_nodes[dev];
+    device_state &st = _dev[dev];
+    Pm::Lock_guard guard(st.lock);
+
+    /* like a clock, a node nobody enabled has nothing to give back */
+    if (!st.refs) return Errno::EINVAL;
+    if (--st.refs) return Errno::ENONE;
+
+    Errno err = Errno::ENONE, e;
+    if (desc.num_pins) err = set_device_pins(dev, false);
+    for (uint32 n = desc.num_clks; n-- > 0;) {
+        e = disable_device_clk(desc.clks[n].id, st.saved_rate[n]);
+        if (err == Errno::ENONE) err = e;
+    }
+    e = request_domains(desc.pds, false);
+    if (err == Errno::ENONE) err = e;
+
+    publish_node(drv_ipc::DEVICE_NODE_BASE + dev, 0);
+    return err;
+}
+
+Errno
+Rpi4::enable_node(uint64 node_id) {
+    if (node_id < RPI_POWER_DOMAIN_COUNT) return request_domains(1u << node_id, true);
+    if (node_id >= drv_ipc::DEVICE_NODE_BASE && node_id < drv_ipc::NODE_DEVICE_END)
+        return enable_device(static_cast<uint32>(node_id - drv_ipc::DEVICE_NODE_BASE));
+    return Errno::EINVAL;
 }
 
 Errno
 Rpi4::disable_node(uint64 node_id) {
-    if (node_id > RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
+    if (node_id < RPI_POWER_DOMAIN_COUNT) return request_domains(1u << node_id, false);
+    if (node_id >= drv_ipc::DEVICE_NODE_BASE && node_id < drv_ipc::NODE_DEVICE_END)
+        return disable_device(static_cast<uint32>(node_id - drv_ipc::DEVICE_NODE_BASE));
+    return Errno::EINVAL;
+}
+
+Errno
+Rpi4::set_clk_autosuspend(uint64 clk_id, uint64 delay_ns) {
+    rpi_clock *clk = _clock_manager.get_clock(static_cast<uint8>(clk_id));
+    if (!clk) return Errno::EINVAL;
+    clk_guard guard(_clock_manager, static_cast<uint8>(clk_id), false);
+    _clock_manager.set_autosuspend(static_cast<uint8>(clk_id), Pm::ns_to_ticks(delay_ns));
+    return Errno::ENONE;
+}
+
+/* for a device node, the delay of each of its domains and clocks */
+Errno
+Rpi4::set_node_autosuspend(uint64 node_id, uint64 delay_ns) {
+    uint64 delay = Pm::ns_to_ticks(delay_ns);
+
+    if (node_id < RPI_POWER_DOMAIN_COUNT) {
+        set_pd_autosuspend(static_cast<uint32>(node_id), delay);
+        return Errno::ENONE;
+    }
+    if (node_id < drv_ipc::DEVICE_NODE_BASE || node_id >= drv_ipc::NODE_DEVICE_END)
+        return Errno::EINVAL;
+
+    const device_desc &desc = device_nodes[node_id - drv_ipc::DEVICE_NODE_BASE];
+    for (uint32 m = desc.pds; m; m &= m - 1)
+        set_pd_autosuspend(static_cast<uint32>(__builtin_ctz(m)), delay);
+    for (uint32 n = 0; n < desc.num_clks; n++)
+        set_clk_autosuspend(desc.clks[n].id, delay_ns);
+    return Errno::ENONE;
+}
+
+/* until the driver collects the outcome of a posted transition itself */
+static uint64
+posted_deadline(void) {
+    return Pm::Idle_timer::deadline(Pm::ns_to_ticks(drv_ipc::NODE_TOKEN_TTL_NS));
+}
+
+Errno
+Rpi4::post_node_state(Cpu client, uint64 node_id, bool on, uint32 &token) {
+    /* device nodes take several steps, they only come synchronously */
+    if (node_id >= drv_ipc::DEVICE_NODE_BASE && node_id < drv_ipc::NODE_DEVICE_END)
+        return Errno::ENOTSUP;
+    if (node_id >= RPI_POWER_DOMAIN_COUNT) return Errno::EINVAL;
+
+    /* outcomes nobody collected free their slots for this request */
+    reap_posted(Pm::ticks());
+
+    power_domain &pd = _pd[node_id];
+    Pm::Lock_guard guard(pd.lock);
+    if (pd.pending) return Errno::EBUSY;
+
+    uint32 refs = pd.refs;
+    uint64 idle_at = pd.idle_at;
+    if (!pd_request(static_cast<uint32>(node_id), on)) {
+        token = drv_ipc::NODE_TOKEN_DONE;
+        return Errno::ENONE;
+    }
+
+    /*
+     * Taken before the firmware sees the request, so its outcome always has
+     * a place. Until then the entry matches no token and never expires.
+     */
+    posted_node *posted = nullptr;
+    {
+        Pm::Lock_guard posted_guard(_posted_lock);
+        for (auto &p : _posted) {
+            if (p.used) continue;
+            p = {drv_ipc::NODE_TOKEN_DONE, 0, 0, 0, 0, client, Pm::Idle_timer::NEVER, true};
+            posted = &p;
+            break;
+        }
+    }
+
+    Errno err = posted ? _fw.post_power_domain(static_cast<uint32>(node_id), on ? 1 : 0, token)
+                       : Errno::EBUSY;
+    if (err != Errno::ENONE) {
+        pd.refs = refs;
+        pd.idle_at = idle_at;
+        if (posted) {
+            Pm::Lock_guard posted_guard(_posted_lock);
+            posted->used = false;
+        }
+        return err;
+    }
+    pd.pending = true;
+
+    uint64 expires = posted_deadline();
+    Pm::Lock_guard posted_guard(_posted_lock);
+    *posted = {token, static_cast<uint32>(node_id), on ? 1u : 0u, refs, idle_at, client, expires,
+               true};
+    _posted_reap.arm(expires);
+    return err;
+}
+
+void
+Rpi4::finish_node_state(const posted_node &done, Errno err) {
+    /* nothing moved the domain while the transition was pending */
+    power_domain &pd = _pd[done.node_id];
+    Pm::Lock_guard guard(pd.lock);
+    pd.pending = false;
+    if (err != Errno::ENONE) {
+        /* the request stopped the idle timer, a scan meanwhile dropped the domain */
+        pd.refs = done.refs;
+        pd.idle_at = done.idle_at;
+        if (pd.idle_at) {
+            __atomic_fetch_or(&_idle_pds, 1u << done.node_id, __ATOMIC_SEQ_CST);
+            _pd_idle.arm(pd.idle_at);
+        }
+        return;
+    }
+    pd.on = done.state != 0;
+    publish_node(done.node_id, done.state);
+}
+
+Errno
+Rpi4::complete_node_state(Cpu client, uint32 token) {
+    if (token == drv_ipc::NODE_TOKEN_DONE) return Errno::ENONE;
+
+    posted_node done;
+    Errno err;
+    {
+        Pm::Lock_guard guard(_posted_lock);
+        posted_node *posted = nullptr;
+        for (auto &p : _posted)
+            if (p.used && p.token == token && p.client == client) posted = &p;
+        if (!posted) return Errno::EINVAL;
+
+        err = _fw.complete(token);
+        if (err == Errno::EBUSY) return err;
+        done = *posted;
+        posted->used = false;
+    }
+
+    finish_node_state(done, err);
+    return err;
+}
+
+void
+Rpi4::reap_posted(uint64 now) {
+    if (!_posted_reap.take(now)) return;
+
+    posted_node done[RPI_FW_MAX_SLOTS];
+    Errno errs[RPI_FW_MAX_SLOTS];
+    uint32 num = 0;
+    {
+        Pm::Lock_guard guard(_posted_lock);
+        for (auto &p : _posted) {
+            if (!p.used) continue;
+            if (p.expires <= now) {
+                Errno err = _fw.complete(p.token);
+                if (err != Errno::EBUSY) {
+                    errs[num] = err;
+                    done[num++] = p;
+                    p.used = false;
+                    continue;
+                }
+                /* the firmware is late, give it another period */
+                p.expires = posted_deadline();
+            }
+            _posted_reap.arm(p.expires);
+        }
+    }
 
-    return _fw.set_power_domain(static_cast<uint32>(node_id), 0);
+    for (uint32 i = 0; i < num; i++)
+        finish_node_state(done[i], errs[i]);
 }
\ No newline at end of file
@@ -37,9 +37,11 @@ bcm2835_pll::prepare(void) {
     /* Take the PLL out of reset. */
     _cprman->write(_data->cm_ctrl_reg, _cprman->read(_data->cm_ctrl_reg) & ~CM_PLL_ANARST);
 
-    /* Wait for the PLL to lock. */
-    while (!(_cprman->read(CM_LOCK) & _data->lock_mask)) {
-        /*FIXME:use delay*/
+    /* Wait for the PLL to lock, a PLL that never does goes back into reset. */
+    Errno err = _cprman->wait_for(CM_LOCK, _data->lock_mask, _data->lock_mask, LOCK_TIMEOUT_NS);
+    if (err != Errno::ENONE) {
+        unprepare();
+        return err;
     }
 
     _cprman->write(_data->a2w_ctrl_reg,
@@ -70,7 +72,7 @@ bcm2835_pll::get_rate(void) {
     uint32 a2wctrl = _cprman->read(_data->a2w_ctrl_reg);
     uint32 ndiv, pdiv, fdiv;
     bool using_prediv;
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
+    uint64 parent_rate = _cprman->get_rate(_parent);
 
     if (parent_rate == 0) return 0;
 
@@ -120,7 +122,7 @@ bcm2835_pll::set_rate(uint64 rate) {
     uint32 ndiv, fdiv, a2w_ctl;
     uint32 ana[4];
     int i;
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
+    uint64 parent_rate = _cprman->get_rate(_parent);
 
     if (rate > _data->max_fb_rate) {
         use_fb_prediv = true;
@@ -154,7 +156,7 @@ bcm2835_pll::set_rate(uint64 rate) {
     }
 
     /* Unmask the reference clock from the oscillator. */
-    _cprman->write(A2W_XOSC_CTRL, _cprman->read(A2W_XOSC_CTRL) | _data->reference_enable_mask);
+    _cprman->modify_shared(A2W_XOSC_CTRL, 0, _data->reference_enable_mask);
 
     if (do_ana_setup_first) write_ana(_data->ana_reg_base, ana);
 
@@ -176,7 +178,7 @@ bcm2835_pll::set_rate(uint64 rate) {
 long
 bcm2835_pll::round_rate(uint64 rate) {
     uint32 ndiv, fdiv;
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
+    uint64 parent_rate = _cprman->get_rate(_parent);
 
     rate = (rate > _data->min_rate) ? ((rate < _data->max_rate) ? rate : _data->max_rate) :
                                       _data->min_rate;
@@ -232,7 +234,7 @@ bcm2835_pll_divider::unprepare(void) {
 uint64
 bcm2835_pll_divider::get_rate(void) {
     unsigned int val;
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
+    uint64 parent_rate = _cprman->get_rate(_parent);
 
     val = _cprman->read(_data->a2w_reg) >> A2W_PLL_DIV_SHIFT;
     val &= (1u << (A2W_PLL_DIV_BITS + 1)) - 1;
@@ -245,7 +247,7 @@ bcm2835_pll_divider::get_rate(void) {
 Errno
 bcm2835_pll_divider::set_rate(uint64 rate) {
     uint32 cm, div, max_div = 1 << A2W_PLL_DIV_BITS;
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
+    uint64 parent_rate = _cprman->get_rate(_parent);
 
     div = static_cast<uint32>(CLOCK_DIV_UP(parent_rate, rate));
 
@@ -261,8 +263,12 @@ bcm2835_pll_divider::set_rate(uint64 rate) {
 }
 
 long
-bcm2835_pll_divider::round_rate(uint64) {
-    return -1;
+bcm2835_pll_divider::round_rate(uint64 rate) {
+    uint64 parent_rate = _cprman->get_rate(_parent);
+    if (!rate || !parent_rate) return -1;
+
+    uint64 div = min_t(uint64, CLOCK_DIV_UP(parent_rate, rate), max_div());
+    return static_cast<long>(CLOCK_DIV_UP(parent_rate, div));
 }
 
 Errno
@@ -300,9 +306,7 @@ Errno
 bcm2835_clock::unprepare(void) {
     _cprman->write(_data->ctl_reg, _cprman->read(_data->ctl_reg) & ~CM_ENABLE);
 
-    while (_cprman->read(_data->ctl_reg) & CM_BUSY)
-        ;
-    return Errno::ENONE;
+    return _cprman->wait_for(_data->ctl_reg, CM_BUSY, 0, LOCK_TIMEOUT_NS);
 }
 
 long
@@ -329,11 +333,11 @@ bcm2835_clock::rate_from_divisor(uint64 parent_rate, uint32 div) {
 uint64
 bcm2835_clock::get_rate(void) {
     uint32 div;
-    rpi_clock *parent = _cprman->get_clock(_data->parents[get_parent()]);
+    uint8 parent = _data->parents[get_parent()];
 
-    if (!parent) return 0;
+    if (!_cprman->get_clock(parent)) return 0;
 
-    uint64 parent_rate = parent->get_rate();
+    uint64 parent_rate = _cprman->get_rate(parent);
 
     if (_data->int_bits == 0 && _data->frac_bits == 0) return parent_rate;
 
@@ -349,13 +353,24 @@ bcm2835_clock::choose_div(uint64 rate, uint64 parent_rate, bool round_up) {
     uint64 rem;
     uint32 div, mindiv, maxdiv;
 
-    rem = temp / rate;
-    div = static_cast<uint32>(temp);
+    rem = temp % rate;
+    /* saturate, the clamping below brings very low rates back in range */
+    div = static_cast<uint32>(min_t(uint64, temp / rate, GENMASK(30, 0)));
 
     /* Round up and mask off the unused bits */
     if (round_up && ((div & unused_frac_mask) != 0 || rem != 0)) div += unused_frac_mask + 1;
     div &= ~unused_frac_mask;
 
+    /* apply the clamping  limits */
+    div_limits(mindiv, maxdiv);
+    div = max_t(uint32, div, mindiv);
+    div = min_t(uint32, div, maxdiv);
+
+    return div;
+}
+
+void
+bcm2835_clock::div_limits(uint32 &mindiv, uint32 &maxdiv) {
     /* different clamping limits apply for a mash clock */
     if (_data->is_mash_clock) {
         /* clamp to min divider of 2 */
@@ -369,20 +384,36 @@ bcm2835_clock::choose_div(uint64 rate, uint64 parent_rate, bool round_up) {
         maxdiv
             = GENMASK(_data->int_bits + CM_DIV_FRAC_BITS - 1, CM_DIV_FRAC_BITS - _data->frac_bits);
     }
+}
 
-    /* apply the clamping  limits */
-    div = max_t(uint32, div, mindiv);
-    div = min_t(uint32, div, maxdiv);
+void
+bcm2835_clock::rate_range(uint64 parent_rate, uint64 &min, uint64 &max) {
+    uint32 mindiv, maxdiv;
 
-    return div;
+    if (_data->int_bits == 0 && _data->frac_bits == 0) {
+        min = max = parent_rate;
+        return;
+    }
+
+    div_limits(mindiv, maxdiv);
+    min = static_cast<uint64>(rate_from_divisor(parent_rate, maxdiv));
+    max = static_cast<uint64>(rate_from_divisor(parent_rate, mindiv));
 }
 
 Errno
 bcm2835_clock::set_rate(uint64 rate) {
-    uint64 parent_rate = (_cprman->get_clock(_parent))->get_rate();
-    uint32 div = choose_div(rate, parent_rate, false);
+    uint64 parent_rate = _cprman->get_rate(_parent);
+    if (!rate || !parent_rate) return Errno::EINVAL;
+
+    return set_div(choose_div(rate, parent_rate, false));
+}
+
+Errno
+bcm2835_clock::set_div(uint32 div) {
     uint32 ctl;
 
+    if (_data->int_bits == 0 && _data->frac_bits == 0) return Errno::ENONE;
+
     /*
      * Setting up frac support
      *
@@ -401,41 +432,45 @@ bcm2835_clock::set_rate(uint64 rate) {
 }
 
 long
-bcm2835_clock::round_rate(uint64) {
-    return -1;
+bcm2835_clock::round_rate(uint64 rate) {
+    struct clk_rate_request req = {rate, 0, 0, 0, BCM2711_INVALID};
+
+    if (determine_rate(&req) != Errno::ENONE) return -1;
+    return static_cast<long>(req.rate);
 }
 
 uint64
-bcm2835_clock::choose_div_and_prate(uint64 rate, uint32 *div, uint64 *prate, uint64 *avgrate) {
-    rpi_clock *parent;
-
-    parent = _cprman->get_clock(_parent);
-
-    *prate = parent->get_rate();
-    *div = choose_div(rate, *prate, true);
+bcm2835_clock::rate_for_parent(uint64 rate, uint64 parent_rate, bool round_up, uint32 &div,
+                               uint64 &avgrate) {
+    if (!rate || !parent_rate) {
+        div = 0;
+        avgrate = 0;
+        return 0;
+    }
 
-    *avgrate = static_cast<uint64>(rate_from_divisor(*prate, *div));
+    div = choose_div(rate, parent_rate, round_up);
+    avgrate = static_cast<uint64>(rate_from_divisor(parent_rate, div));
 
-    if (_data->low_jitter && (*div & CM_DIV_FRAC_MASK)) {
+    if (_data->low_jitter && (div & CM_DIV_FRAC_MASK)) {
         unsigned long high, low;
-        uint32 int_div = *div & ~CM_DIV_FRAC_MASK;
+        uint32 int_div = div & ~CM_DIV_FRAC_MASK;
 
-        high = static_cast<unsigned long>(rate_from_divisor(*prate, int_div));
+        high = static_cast<unsigned long>(rate_from_divisor(parent_rate, int_div));
         int_div += CM_DIV_FRAC_MASK + 1;
-        low = static_cast<unsigned long>(rate_from_divisor(*prate, int_div));
+        low = static_cast<unsigned long>(rate_from_divisor(parent_rate, int_div));
 
         /*
          * Return a value which is the maximum deviation
          * below the ideal rate, for use as a metric.
          */
-        return *avgrate - max(*avgrate - low, high - *avgrate);
+        return avgrate - max(avgrate - low, high - avgrate);
     }
-    return *avgrate;
+    return avgrate;
 }
 
+/* closest rate not above req->rate from the parents as they run now */
 Errno
 bcm2835_clock::determine_rate(struct clk_rate_request *req) {
-    rpi_clock *parent;
     uint8 best_parent = BCM2711_INVALID;
     bool current_parent_is_pllc;
     uint64 rate, best_rate = 0;
@@ -449,8 +484,7 @@ bcm2835_clock::determine_rate(struct clk_rate_request *req) {
      * Select parent clock that results in the closest but lower rate
      */
     for (i = 0; i < _data->num_mux_parents; ++i) {
-        parent = _cprman->get_clock(_data->parents[i]);
-        if (!parent) continue;
+        if (!_cprman->get_clock(_data->parents[i])) continue;
 
         /*
          * Don't choose a PLLC-derived clock as our parent
@@ -463,7 +497,8 @@ bcm2835_clock::determine_rate(struct clk_rate_request *req) {
             && !current_parent_is_pllc)
             continue;
 
-        rate = choose_div_and_prate(req->rate, &div, &prate, &avgrate);
+        prate = _cprman->get_rate(_data->parents[i]);
+        rate = rate_for_parent(req->rate, prate, true, div, avgrate);
         if (rate > best_rate && rate <= req->rate) {
             best_parent = _data->parents[i];
             best_prate = prate;
@@ -489,7 +524,14 @@ bcm2835_clock::set_parent(uint8 idx) {
     uint8 src = idx & CM_SRC_MASK;
     bool was_enabled = is_prepared();
 
-    if (was_enabled) unprepare();
+    if (was_enabled) {
+        /* the divider never went idle, leave it running from the old source */
+        Errno err = unprepare();
+        if (err != Errno::ENONE) {
+            prepare();
+            return err;
+        }
+    }
 
     uint32 ctrl = _cprman->read(_data->ctl_reg);
     ctrl &= ~(CM_SRC_MASK);
@@ -506,7 +548,9 @@ uint8
 bcm2835_clock::get_parent(void) {
     uint8 src = _cprman->read(_data->ctl_reg) & CM_SRC_MASK;
 
-    if (src != _parent) _parent = src; /*changed by firmware?*/
+    /*changed by firmware?*/
+    if (src < _data->num_mux_parents && _data->parents[src] != _parent)
+        _parent = _data->parents[src];
 
     return src;
 }
@@ -594,7 +638,7 @@ bcm2835_gate::unprepare(void) {
 
 uint64
 bcm2835_gate::get_rate(void) {
-    return _cprman->get_clock(_parent)->get_rate();
+    return _cprman->get_rate(_parent);
 }
 
 Errno
@@ -629,19 +673,581 @@ bcm2835_aux_clk::is_prepared(void) {
 
 Errno
 bcm2835_aux_clk::prepare(void) {
-    _cprman->write_aux(_data->ctl_reg, _cprman->read_aux(_data->ctl_reg) | (1u << _shift));
+    _cprman->modify_aux(_data->ctl_reg, 0, 1u << _shift);
     return Errno::ENONE;
 }
 
 Errno
 bcm2835_aux_clk::unprepare(void) {
-    _cprman->write_aux(_data->ctl_reg, _cprman->read_aux(_data->ctl_reg) & ~(1u << _shift));
+    _cprman->modify_aux(_data->ctl_reg, 1u << _shift, 0);
     return Errno::ENONE;
 }
 
+static constexpr clk_tree_index rpi4_clk_tree;
+
+static_assert(rpi4_clk_tree.descendants(BCM2835_PLLD) & (1ull << BCM2711_CLOCK_EMMC2),
+              "EMMC2 must be reachable from PLLD");
+static_assert(rpi4_clk_tree.descendants(BCM2835_CLOCK_VPU) & (1ull << BCM2711_CLOCK_AUX_SPI2),
+              "AUX clocks must be reachable from the VPU clock");
+
 cprman::cprman(void) {
-    for (uint16 i = 0; i < BCM2711_CLOCK_TOTAL; i++)
+    for (uint16 i = 0; i < BCM2711_CLOCK_TOTAL; i++) {
         _clks[i] = nullptr;
+        _rates[i] = 0;
+    }
+    _rates_valid = 0;
+    _index_valid = 0;
+    _dirty = 0;
+    _published = 0;
+    _idle_armed = 0;
+    reset_stats();
+    for (uint16 i = 0; i < BCM2711_CLOCK_TOTAL; i++) {
+        _idle_delay[i] = 0;
+        _idle_at[i] = 0;
+        _users[i] = 0;
+        _children_on[i] = 0;
+        _channel_max[i] = 0;
+        _domain[i] = CLK_DOMAIN_OSC;
+        _mux_domains[i] = 0;
+    }
+}
+
+uint64
+cprman::get_rate(uint8 id) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return 0;
+
+    if (!(__atomic_load_n(&_rates_valid, __ATOMIC_ACQUIRE) & RATE_BIT(id))) {
+        _rates[id] = clk->get_rate();
+        __atomic_fetch_or(&_rates_valid, RATE_BIT(id), __ATOMIC_RELEASE);
+    }
+    return _rates[id];
+}
+
+void
+cprman::invalidate_rate(uint8 id) {
+    if (id >= BCM2711_CLOCK_TOTAL) return;
+    /*
+     * The static tree reaches clocks that currently sit in another domain, so
+     * the bitmaps are shared between domains and only changed atomically.
+     */
+    uint64 bits = RATE_BIT(id) | rpi4_clk_tree.descendants(id);
+    __atomic_fetch_and(&_rates_valid, ~bits, __ATOMIC_RELEASE);
+    __atomic_fetch_and(&_index_valid, ~bits, __ATOMIC_RELEASE);
+    __atomic_fetch_or(&_dirty, bits, __ATOMIC_RELEASE);
+}
+
+uint8
+cprman::find_domain(uint8 id) {
+    /* no clock is more than a few levels below its PLL */
+    for (uint8 depth = 0; depth < 8 && get_clock(id); depth++) {
+        switch (id) {
+        case BCM2835_PLLA:
+            return CLK_DOMAIN_PLLA;
+        case BCM2835_PLLC:
+            return CLK_DOMAIN_PLLC;
+        case BCM2835_PLLD:
+            return CLK_DOMAIN_PLLD;
+        case BCM2835_PLLH:
+            return CLK_DOMAIN_PLLH;
+        default:
+            id = get_clock(id)->get_parent_id();
+            break;
+        }
+    }
+    return CLK_DOMAIN_OSC;
+}
+
+bool
+cprman::matches_topology(uint8 id) {
+    clk_topology topo = clk_topology_of(id);
+    rpi_clock *clk = _clks[id];
+    if (!clk) return topo.num_parents == 0;
+
+    uint8 n = 0;
+    for (uint8 idx = 0; idx < BCM2711_MAX_CLK_PARENTS; idx++) {
+        uint8 p = clk->mux_parent_id(idx);
+        if (p == BCM2711_INVALID) continue;
+        if (n >= topo.num_parents || topo.parents[n] != p) return false;
+        n++;
+    }
+
+    /* not a mux, the parent is fixed */
+    if (n == 0 && clk->get_parent_id() != BCM2711_INVALID) {
+        if (topo.num_parents == 0 || topo.parents[0] != clk->get_parent_id()) return false;
+        n = 1;
+    }
+
+    return n == topo.num_parents;
+}
+
+void
+cprman::update_domains(uint64 ids) {
+    for (uint8 id = 0; id < BCM2711_CLOCK_TOTAL; id++) {
+        rpi_clock *clk = get_clock(id);
+        if (!clk || !(ids & RATE_BIT(id))) continue;
+
+        __atomic_store_n(&_domain[id], find_domain(id), __ATOMIC_RELEASE);
+
+        uint8 mask = 0;
+        for (uint8 i = 0; i < BCM2711_MAX_CLK_PARENTS; i++) {
+            uint8 parent = clk->mux_parent_id(i);
+            if (get_clock(parent)) mask |= static_cast<uint8>(1u << find_domain(parent));
+        }
+        _mux_domains[id] = mask;
+    }
+}
+
+uint8
+cprman::domains(uint8 id, bool reroute) {
+    uint8 mask = static_cast<uint8>(1u << __atomic_load_n(&_domain[id], __ATOMIC_ACQUIRE));
+    return reroute ? (mask | _mux_domains[id]) : mask;
+}
+
+uint8
+cprman::lock(uint8 id, bool reroute) {
+    while (true) {
+        uint8 held = domains(id, reroute);
+        for (uint8 d = 0; d < CLK_DOMAIN_COUNT; d++)
+            if (held & (1u << d)) _locks[d].lock();
+
+        /* the clock may have been moved to another subtree while we waited */
+        if (!(domains(id, reroute) & ~held)) return held;
+        unlock(held);
+    }
+}
+
+void
+cprman::publish_clock(uint8 id) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return;
+    _state[id].write({get_rate(id), clk->get_parent_id(), clk->is_prepared()});
+    __atomic_fetch_or(&_published, RATE_BIT(id), __ATOMIC_RELEASE);
+}
+
+void
+cprman::publish(uint8 held) {
+    uint64 dirty = __atomic_load_n(&_dirty, __ATOMIC_ACQUIRE);
+
+    /*
+     * Dirty clocks in other domains are statically below the change but
+     * currently run from elsewhere, their snapshot is still right.
+     */
+    for (uint8 id = 0; dirty && id < BCM2711_CLOCK_TOTAL; id++) {
+        if (!(dirty & RATE_BIT(id)) || !(held & (1u << _domain[id]))) continue;
+        __atomic_fetch_and(&_dirty, ~RATE_BIT(id), __ATOMIC_RELAXED);
+        publish_clock(id);
+    }
+}
+
+void
+cprman::unlock(uint8 held) {
+    publish(held);
+    for (uint8 d = CLK_DOMAIN_COUNT; d-- > 0;)
+        if (held & (1u << d)) _locks[d].unlock();
+}
+
+const clk_rate_index *
+cprman::rate_index(uint8 id) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return nullptr;
+
+    clk_rate_index &index = _index[id];
+    if (__atomic_load_n(&_index_valid, __ATOMIC_ACQUIRE) & RATE_BIT(id))
+        return index.has_mux ? &index : nullptr;
+
+    /* the parents plan_rate() may pick without touching their rate */
+    uint8 current = clk->get_parent_id();
+    index.has_mux = false;
+    index.num_src = 0;
+    index.min = ~0ull;
+    index.max = 0;
+    for (uint8 i = 0; i < BCM2711_MAX_CLK_PARENTS; i++) {
+        uint8 parent = clk->mux_parent_id(i);
+        if (parent != BCM2711_INVALID) index.has_mux = true;
+        if (!get_clock(parent)) continue;
+        if (is_pllc(parent) && !is_pllc(current)) continue;
+
+        uint64 parent_rate = get_rate(parent);
+        if (!parent_rate) continue;
+
+        auto &src = index.src[index.num_src++];
+        src.parent = parent;
+        src.parent_idx = i;
+        src.parent_rate = parent_rate;
+        clk->rate_range(parent_rate, src.min, src.max);
+
+        index.min = min_t(uint64, index.min, src.min);
+        index.max = max_t(uint64, index.max, src.max);
+    }
+    if (!index.num_src) index.min = 0;
+
+    __atomic_fetch_or(&_index_valid, RATE_BIT(id), __ATOMIC_RELEASE);
+    return index.has_mux ? &index : nullptr;
+}
+
+Errno
+cprman::describe_rate(uint8 id, Pm::clk_desc &desc) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    const clk_rate_index *index = rate_index(id);
+    if (!index) return clk->describe_rate(desc);
+    if (!index->num_src) return Errno::ENOTSUP;
+
+    /* rates are parent_rate / div, not evenly spaced: step 0, use round_rate() */
+    desc.triplet = true;
+    desc.min = static_cast<uint32>(index->min);
+    desc.max = static_cast<uint32>(min_t(uint64, index->max, ~0u));
+    desc.step = 0;
+    return Errno::ENONE;
+}
+
+Errno
+cprman::round_rate(uint8 id, uint64 rate, uint64 &rounded) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk || !rate) return Errno::EINVAL;
+
+    const clk_rate_index *index = rate_index(id);
+    if (!index) {
+        long r = clk->round_rate(rate);
+        if (r < 0) return Errno::ENOTSUP;
+        rounded = static_cast<uint64>(r);
+        return Errno::ENONE;
+    }
+
+    uint64 best_err = ~0ull;
+    for (uint8 i = 0; i < index->num_src; i++) {
+        auto &src = index->src[i];
+
+        /* nothing in this range beats what we have */
+        uint64 gap = (rate < src.min) ? src.min - rate : (rate > src.max) ? rate - src.max : 0;
+        if (gap >= best_err) continue;
+
+        for (uint32 pass = 0; pass < 2; pass++) {
+            uint32 div;
+            uint64 avgrate;
+            clk->rate_for_parent(rate, src.parent_rate, pass == 0, div, avgrate);
+            uint64 err = (avgrate > rate) ? avgrate - rate : rate - avgrate;
+            if (avgrate && err < best_err) {
+                best_err = err;
+                rounded = avgrate;
+            }
+        }
+    }
+    return (best_err == ~0ull) ? Errno::ENOTSUP : Errno::ENONE;
+}
+
+Errno
+cprman::wait_for(uint32 reg, uint32 mask, uint32 val, uint64 timeout_ns, bool backoff) {
+    uint64 deadline = Pm::ticks() + Pm::ns_to_ticks(timeout_ns);
+    uint32 pause = 1;
+
+    while ((read(reg) & mask) != val) {
+        /* look once more after the deadline in case we were preempted past it */
+        if (Pm::ticks() > deadline)
+            return ((read(reg) & mask) == val) ? Errno::ENONE : Errno::ETIMEDOUT;
+
+        for (uint32 i = 0; i < pause; i++)
+            Pm::relax();
+        if (backoff && pause < CPRMAN_WAIT_BACKOFF) pause <<= 1;
+    }
+    return Errno::ENONE;
+}
+
+Errno
+cprman::prepare(uint8 id) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    uint64 start = Pm::ticks();
+    Errno err = clk->prepare();
+    uint64 t = Pm::ticks() - start;
+    _stats[CLK_STAT_PREPARE].record(t);
+    if (clk->is_pll()) _stats[CLK_STAT_PLL_LOCK].record(t);
+
+    invalidate_rate(id);
+    return err;
+}
+
+Errno
+cprman::unprepare(uint8 id) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    uint64 start = Pm::ticks();
+    Errno err = clk->unprepare();
+    _stats[CLK_STAT_UNPREPARE].record(Pm::ticks() - start);
+
+    invalidate_rate(id);
+    return err;
+}
+
+Errno
+cprman::set_parent(uint8 id, uint8 idx) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    uint8 old_parent = clk->get_parent_id(), new_parent = clk->mux_parent_id(idx);
+    bool running = clk->is_prepared();
+
+    /* a running clock moves its reference, the new parent must be up first */
+    if (running && get_clock(new_parent)) {
+        Errno err = get_child_ref(new_parent);
+        if (err != Errno::ENONE) return err;
+    }
+
+    uint64 start = Pm::ticks();
+    Errno err = clk->set_parent(idx);
+    _stats[CLK_STAT_SET_PARENT].record(Pm::ticks() - start);
+    invalidate_rate(id);
+    if (err == Errno::ENONE) update_domains(RATE_BIT(id) | rpi4_clk_tree.descendants(id));
+
+    if (running) {
+        uint8 unused = (err == Errno::ENONE) ? old_parent : new_parent;
+        if (get_clock(unused)) put_child_ref(unused);
+    }
+    return err;
+}
+
+Errno
+cprman::set_rate(uint8 id, uint64 rate) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    clk_rate_plan plan;
+    Errno err = plan_rate(id, rate, 0, plan);
+    if (err == Errno::ENONE) return apply_rate_plan(id, plan);
+    if (err != Errno::ENOTSUP) return err;
+
+    uint64 start = Pm::ticks();
+    err = clk->set_rate(rate);
+    _stats[CLK_STAT_SET_RATE].record(Pm::ticks() - start);
+    invalidate_rate(id);
+    return err;
+}
+
+/* a PLL channel can be re-divided when the clock being planned is its only user */
+bool
+cprman::can_redivide(uint8 parent, uint8 child) {
+    if (is_pllc(parent)) return false;
+
+    rpi_clock *clk = get_clock(child);
+    uint16 ours = (clk->is_prepared() && clk->get_parent_id() == parent) ? 1 : 0;
+    return !_users[parent] && _children_on[parent] == ours;
+}
+
+Errno
+cprman::plan_rate(uint8 id, uint64 rate, uint64 tolerance, clk_rate_plan &plan) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk || !rate) return Errno::EINVAL;
+
+    uint8 current = clk->get_parent_id();
+    bool has_mux = false;
+    uint64 best_err = ~0ull;
+    uint32 best_cost = ~0u;
+
+    auto consider = [&](uint8 parent, uint8 idx, uint32 parent_div, uint64 parent_rate) {
+        /* rounding the divisor down may hit the rate exactly, the filter drops the rest */
+        for (uint32 pass = 0; pass < 2; pass++) {
+            uint32 div;
+            uint64 avgrate;
+            uint64 metric = clk->rate_for_parent(rate, parent_rate, pass == 0, div, avgrate);
+            if (!avgrate || avgrate > rate + tolerance) continue;
+
+            /* same accuracy: prefer fewer changes to the tree */
+            uint64 err = (metric > rate) ? metric - rate : rate - metric;
+            uint32 cost = (parent != current) + (parent_div != 0);
+            if (err > best_err || (err == best_err && cost >= best_cost)) continue;
+
+            best_err = err;
+            best_cost = cost;
+            plan = {parent, idx, parent_div, parent_rate, div, avgrate};
+        }
+    };
+
+    for (uint8 i = 0; i < BCM2711_MAX_CLK_PARENTS; i++) {
+        uint8 parent_id = clk->mux_parent_id(i);
+        rpi_clock *parent = get_clock(parent_id);
+        if (parent_id != BCM2711_INVALID) has_mux = true;
+        if (!parent) continue;
+        if (is_pllc(parent_id) && !is_pllc(current)) continue;
+
+        consider(parent_id, i, 0, get_rate(parent_id));
+
+        if (!parent->max_div() || !can_redivide(parent_id, id)) continue;
+
+        /* channel rates only go down with the divider, stop below the target */
+        uint64 pll_rate = get_rate(parent->get_parent_id());
+        for (uint32 n = 1; n <= parent->max_div() && best_err; n++) {
+            uint64 parent_rate = CLOCK_DIV_UP(pll_rate, static_cast<uint64>(n));
+            if (parent_rate > _channel_max[parent_id]) continue;
+            consider(parent_id, i, n, parent_rate);
+            if (parent_rate < rate) break;
+        }
+    }
+
+    if (!has_mux) return Errno::ENOTSUP;
+    if (best_err == ~0ull) return Errno::EINVAL;
+    return Errno::ENONE;
+}
+
+Errno
+cprman::planned_rate(uint8 id, uint64 rate, uint64 &planned) {
+    clk_rate_plan plan;
+    Errno err = plan_rate(id, rate, 0, plan);
+    if (err == Errno::ENONE) planned = plan.rate;
+    if (err != Errno::ENOTSUP) return err;
+
+    /* no mux, the clock's own set_rate() lands where its round_rate() says */
+    long r = get_clock(id)->round_rate(rate);
+    if (r < 0) return Errno::ENOTSUP;
+    planned = static_cast<uint64>(r);
+    return Errno::ENONE;
+}
+
+Errno
+cprman::apply_rate_plan(uint8 id, const clk_rate_plan &plan) {
+    rpi_clock *clk = get_clock(id);
+    if (!clk) return Errno::EINVAL;
+
+    Errno err = Errno::ENONE;
+    if (plan.parent_div) err = set_rate(plan.parent, plan.parent_rate);
+    if (err != Errno::ENONE) return err;
+
+    if (plan.parent != clk->get_parent_id()) err = set_parent(id, plan.parent_idx);
+    if (err != Errno::ENONE) return err;
+
+    uint64 start = Pm::ticks();
+    err = clk->set_div(plan.div);
+    _stats[CLK_STAT_SET_RATE].record(Pm::ticks() - start);
+    invalidate_rate(id);
+    return err;
+}
+
+/* nothing is done for a clock that is already running, it holds its parent */
+Errno
+cprman::power_up(uint8 id) {
+    /* still running from before its idle timer expired */
+    if (_idle_at[id]) {
+        _idle_at[id] = 0;
+        return Errno::ENONE;
+    }
+
+    rpi_clock *clk = get_clock(id);
+    if (clk->is_prepared()) return Errno::ENONE;
+
+    uint8 parent = clk->get_parent_id();
+    if (get_clock(parent)) {
+        Errno err = get_child_ref(parent);
+        if (err != Errno::ENONE) return err;
+    }
+
+    Errno err = prepare(id);
+    if (err != Errno::ENONE && get_clock(parent)) put_child_ref(parent);
+    return err;
+}
+
+/* clocks that cannot be gated (oscillator, VPU) keep running and keep their parent */
+Errno
+cprman::power_down(uint8 id) {
+    _idle_at[id] = 0;
+
+    rpi_clock *clk = get_clock(id);
+    if (!clk->is_prepared()) return Errno::ENONE;
+
+    Errno err = unprepare(id);
+    if (err != Errno::ENONE) return err;
+
+    uint8 parent = clk->get_parent_id();
+    if (get_clock(parent)) put_child_ref(parent);
+    return Errno::ENONE;
+}
+
+Errno
+cprman::get_child_ref(uint8 parent) {
+    _children_on[parent]++;
+
+    Errno err = power_up(parent);
+    if (err != Errno::ENONE) _children_on[parent]--;
+    return err;
+}
+
+void
+cprman::put_child_ref(uint8 parent) {
+    if (_children_on[parent]) _children_on[parent]--;
+    if (!refs(parent)) release(parent);
+}
+
+Errno
+cprman::release(uint8 id) {
+    if (!_idle_delay[id]) return power_down(id);
+    if (!get_clock(id)->is_prepared()) return Errno::ENONE;
+
+    _idle_at[id] = Pm::Idle_timer::deadline(_idle_delay[id]);
+    __atomic_fetch_or(&_idle_armed, RATE_BIT(id), __ATOMIC_SEQ_CST);
+    _idle_timer.arm(_idle_at[id]);
+    return Errno::ENONE;
+}
+
+void
+cprman::set_autosuspend(uint8 id, uint64 delay) {
+    if (id >= BCM2711_CLOCK_TOTAL) return;
+    _idle_delay[id] = delay;
+
+    /* a running timer expires by the new delay at the latest */
+    uint64 at = Pm::Idle_timer::deadline(delay);
+    if (_idle_at[id] > at) {
+        _idle_at[id] = at;
+        _idle_timer.arm(_idle_at[id]);
+    }
+}
+
+void
+cprman::expire_idle(uint64 now) {
+    if (!_idle_timer.take(now)) return;
+
+    uint64 armed = __atomic_load_n(&_idle_armed, __ATOMIC_SEQ_CST);
+    for (; armed; armed &= armed - 1) {
+        uint8 id = static_cast<uint8>(__builtin_ctzll(armed));
+        uint8 held = lock(id, false);
+
+        if (_idle_at[id] > now) {
+            _idle_timer.arm(_idle_at[id]);
+        } else {
+            __atomic_fetch_and(&_idle_armed, ~RATE_BIT(id), __ATOMIC_SEQ_CST);
+            /* a failed gate leaves the clock running, like a failed disable */
+            if (_idle_at[id] && !refs(id)) power_down(id);
+            _idle_at[id] = 0;
+        }
+        unlock(held);
+    }
+}
+
+Errno
+cprman::enable(uint8 id) {
+    if (!get_clock(id)) return Errno::EINVAL;
+    if (_users[id] == static_cast<uint16>(~0u)) return Errno::EOVERFLOW;
+
+    _users[id]++;
+
+    Errno err = power_up(id);
+    if (err != Errno::ENONE) _users[id]--;
+    return err;
+}
+
+Errno
+cprman::disable(uint8 id) {
+    if (!get_clock(id)) return Errno::EINVAL;
+
+    if (!_users[id]) {
+        /* running since boot or enabled by the firmware, not ours to count */
+        if (_children_on[id]) return Errno::EBUSY;
+        return power_down(id);
+    }
+
+    if (--_users[id] == 0 && !_children_on[id]) return release(id);
+    return Errno::ENONE;
 }
 
 cprman::~cprman(void) {}
@@ -853,5 +1459,30 @@ cprman::probe(mword base, mword aux_base) {
     for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++)
         if (_clks[i]) _clks[i]->init(this);
 
+    /* the descendant and lock domain index is built from clk_topology_of(), not from _clks */
+    for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++)
+        ASSERT(matches_topology(i));
+
+    /* init may have re-parented clocks, start with an empty rate cache */
+    _rates_valid = 0;
+    _index_valid = 0;
+
+    for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++)
+        if (_clks[i] && _clks[i]->max_div()) _channel_max[i] = get_rate(i);
+
+    update_domains(~0ull);
+
+    /* whatever runs at boot holds its parent, so the chain stays up under it */
+    for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++) {
+        if (!_clks[i] || !_clks[i]->is_prepared()) continue;
+
+        uint8 parent = _clks[i]->get_parent_id();
+        if (get_clock(parent)) _children_on[parent]++;
+    }
+
+    for (uint8 i = 0; i < BCM2711_CLOCK_TOTAL; i++)
+        publish_clock(i);
+    _dirty = 0;
+
     return Errno::ENONE;
 }
\ No newline at end of file